@@ -0,0 +1,80 @@
+#include <hydra/kernel.h>
+#include <stdio.h>
+
+#define ITERATIONS 100000
+
+static inline uint64_t rdtsc(void)
+{
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+#define FAULT_PAGES 256
+#define PAGE_SIZE 4096
+
+// syscall round trip latency, ping is the cheapest syscall there is
+static void bench_syscall(void)
+{
+    uint64_t min = UINT64_MAX;
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < ITERATIONS; i++)
+    {
+        uint64_t start = rdtsc();
+        syscall_ping(0);
+        uint64_t cycles = rdtsc() - start;
+
+        total += cycles;
+        if (cycles < min)
+        {
+            min = cycles;
+        }
+    }
+
+    printf("syscall round trip: %lu cycles average, %lu cycles minimum over %d calls\n", total / ITERATIONS, min, ITERATIONS);
+}
+
+// touches every page once, each write takes a page fault
+static uint64_t touch_pages(volatile uint8_t *pages)
+{
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < FAULT_PAGES; i++)
+    {
+        uint64_t start = rdtsc();
+        pages[i * PAGE_SIZE] = (uint8_t)i;
+        total += rdtsc() - start;
+    }
+
+    return total / FAULT_PAGES;
+}
+
+// demand faults and copy on write breaks, they change the page tables of a process that isn't loaded during the fault
+static void bench_faults(void)
+{
+    volatile uint8_t *pages = syscall_mmap(NULL, FAULT_PAGES * PAGE_SIZE, MMAP_PROT_READ | MMAP_PROT_WRITE, MMAP_PRIVATE | MMAP_ANONYMOUS, 0, 0);
+    if (!pages)
+    {
+        fputs("mmap failed\n", stdout);
+        return;
+    }
+
+    printf("demand fault: %lu cycles average over %d pages\n", touch_pages(pages), FAULT_PAGES);
+
+    int64_t pid = syscall_fork();
+    if (pid == 0)
+    {
+        printf("copy on write fault: %lu cycles average over %d pages\n", touch_pages(pages), FAULT_PAGES);
+        syscall_exit(0);
+    }
+
+    while (pid > 0 && syscall_ping(pid) == pid);
+    syscall_munmap((void *)pages, FAULT_PAGES * PAGE_SIZE);
+}
+
+int main(void)
+{
+    bench_syscall();
+    bench_faults();
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef _KERNEL_ARENA_H
+#define _KERNEL_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <kernel/status.h>
+
+/*
+ per cpu scratch memory for a single operation. arena_alloc is a pointer bump and
+ arena_end releases everything allocated since the matching arena_begin at once.
+ scopes nest, but have to be ended in reverse order and must not be held across a task switch.
+*/
+#define ARENA_BLOCK_ORDER 4 // blocks of 64 KiB, larger allocations get a block of their own
+#define ARENA_ALIGNMENT 16
+
+struct arena_block;
+
+typedef struct
+{
+    struct arena_block *block;
+    size_t offset;
+} arena_t;
+
+arena_t arena_begin(void);
+void *arena_alloc(size_t size);
+char *arena_strdup(const char *str);
+void arena_end(arena_t scope);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _KERNEL_CPU_H
+#define _KERNEL_CPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/status.h>
+
+// only the bootstrap processor runs kernel code for now, so cpu_get_id is always 0.
+// per cpu data (pmm magazines, arenas) is indexed by it and needs a real id once application processors are started
+#define MAX_CPUS 1
+
+uint32_t cpu_get_id(void); // dense index below MAX_CPUS
+bool cpu_has_1gb_pages(void);
+bool cpu_has_pcid(void);
+bool cpu_has_invpcid(void);
+
+#endif
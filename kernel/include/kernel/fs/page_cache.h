@@ -0,0 +1,45 @@
+#ifndef _KERNEL_PAGE_CACHE_H
+#define _KERNEL_PAGE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <kernel/status.h>
+#include <kernel/fs/vfs.h>
+
+#define PAGE_CACHE_READAHEAD 8 // pages read from the file per miss
+
+/*
+ the pages of a file, shared by every mapping of it. a cache is keyed by mount, path and modification time,
+ so a file that changed on disk gets a fresh cache while old mappings keep their pages.
+ the cache holds one pmm reference on every page it caches, mappings take their own.
+*/
+typedef struct page_cache
+{
+    char path[MAX_PATH + 13]; // global path, so it includes the mount
+    uint16_t write_time;
+    uint16_t write_date;
+
+    size_t filesize;
+    size_t num_pages;
+    void **pages; // physical, NULL until the page is first needed
+    size_t num_cached;
+
+    size_t refs;
+    size_t shared_refs; // shared mappings, their writes go back to the file once the last one is gone
+    bool dirty;
+    bool stale; // replaced by a newer cache of the same file, freed with its last reference
+    bool filling;
+
+    struct page_cache *next;
+} page_cache_t;
+
+page_cache_t *page_cache_get(file_node_t *node, bool shared); // finds or creates the cache of the file, takes a reference
+page_cache_t *page_cache_ref(page_cache_t *cache, bool shared);
+void page_cache_put(page_cache_t *cache, bool shared); // cached pages stay around until the pmm runs short
+
+void *page_cache_get_page(page_cache_t *cache, size_t index); // NULL past the end of the file or if reading failed
+int page_cache_writeback(page_cache_t *cache);
+
+#endif
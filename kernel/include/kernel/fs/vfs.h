@@ -58,6 +58,7 @@ int vfs_unmount_blockdev(int id);
 #define SEEK_TYPE_END 2
 
 file_node_t *vfs_open(const char *path, uint8_t action);
+int vfs_get_path(file_node_t *node, char *path, size_t size); // the global path the node was opened with
 int vfs_close(file_node_t *node);
 int vfs_read(file_node_t *node, size_t size, uint8_t *buf);
 int vfs_write(file_node_t *node, size_t size, const uint8_t *buf);
@@ -8,10 +8,70 @@
 #include <kernel/status.h>
 #include <kernel/vmm.h>
 
-int kmm_init(page_table_t *kernel_pml4, uint64_t base, size_t size, size_t alignment);
+// the heap is mapped on demand in chunks inside this range, nothing else may be mapped there
+#define KMM_HEAP_START 0xFFFFC00000000000
+#define KMM_HEAP_MAX_SIZE 0x100000000 // 4 GiB
+
+#define KMM_CHUNK_MIN_SIZE 0x10000   // 64 KiB
+#define KMM_CHUNK_MAX_SIZE 0x1000000 // 16 MiB, also the largest possible kmalloc
+
+// completely free chunks kept mapped until the pmm runs low
+#define KMM_MAX_EMPTY_CHUNKS 1
+
+typedef struct
+{
+    size_t mapped;      // bytes of heap backed by pages
+    size_t peak_mapped; // high-water mark of mapped
+    size_t used;        // bytes in allocated blocks, including headers
+    size_t peak_used;   // high-water mark of used
+    size_t chunks;
+    size_t runs; // size class runs, counted in mapped as well
+} kmm_stats_t;
+
+int kmm_init(page_table_t *kernel_pml4, size_t alignment);
 void *kmalloc(size_t size);
 void kfree(void *ptr);
 
-void *krealloc(void *ptr, size_t old_size, size_t new_size);
+// grows or shrinks in place when possible, the old contents are kept up to the smaller size
+void *krealloc(void *ptr, size_t new_size);
+size_t ksize(void *ptr); // usable size of an allocation, at least what was requested
+
+#ifdef KMM_PROFILE
+// built with `make KMM_PROFILE=1`, every live allocation is recorded together with its caller
+#define KMM_PROFILE_MAX_ALLOCS 8192
+#define KMM_PROFILE_MAX_CALL_SITES 256
+#define KMM_PROFILE_REPORT_MIN_AGE_MS 1000 // used by the ctrl+alt+f12 report of the ps2 keyboard
+
+typedef struct
+{
+    void *caller;
+    size_t live_bytes;
+    size_t live_allocs;
+    uint64_t total_allocs;
+    uint64_t total_bytes;
+} kmm_call_site_t;
+
+typedef struct
+{
+    size_t live_allocs;
+    size_t live_bytes;      // as requested by the callers
+    uint64_t total_allocs;
+    uint64_t total_frees;
+    uint64_t allocs_per_second;
+    uint64_t internal_waste; // bytes lost to rounding up to block or size class sizes
+    uint64_t fragmentation;  // percentage of mapped heap memory not in use
+    uint64_t dropped;        // allocations that didn't fit into the table
+} kmm_profile_stats_t;
+
+void kmm_profile_alloc(void *ptr, size_t size, void *caller);
+void kmm_profile_free(void *ptr);
+
+void kmm_profile_get_stats(kmm_profile_stats_t *stats);
+size_t kmm_profile_get_call_sites(kmm_call_site_t *sites, size_t max_sites);
+void kmm_profile_report(uint64_t min_age_ms); // writes live allocations older than min_age_ms to the e9 port, also bound to ctrl+alt+f12
+#endif
+
+size_t kmm_shrink(void); // unmaps empty chunks and runs, returns the number of pages given back
+void kmm_get_stats(kmm_stats_t *stats);
 
-#endif
\ No newline at end of file
+#endif
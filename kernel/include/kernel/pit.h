@@ -8,6 +8,7 @@
 int pit_init(uint32_t frequency);
 void pit_set_frequency(uint32_t frequency);
 uint32_t pit_get_frequency(void);
+uint64_t pit_get_ticks(void); // since pit_init
 void register_pit_handler(void (*func)(interrupt_frame_t *frame, uint32_t frequency));
 
 void sleep(uint64_t ms);
@@ -2,10 +2,24 @@
 #define _KERNEL_PMM_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <kernel/status.h>
 
 #define PAGE_SIZE 4096
 
+// largest block handed out by pmm_alloc_pages is 2^PMM_MAX_ORDER pages (4 MiB)
+#define PMM_MAX_ORDER 10
+
+// single pages are cached per cpu and moved from/to the buddy allocator in batches
+#define PMM_MAGAZINE_SIZE 64
+#define PMM_MAGAZINE_BATCH 16
+
+// pages zeroed in the background for pmm_alloc_zeroed
+#define PMM_ZERO_POOL_SIZE 64
+#define PMM_ZERO_POOL_REFILL_BUDGET 4 // pages zeroed per timer tick
+
+#define PMM_MAX_SHRINKERS 8
+
 #define MMAP_ENTRY_TYPE_AVAILABLE 1<<0
 #define MMAP_ENTRY_TYPE_RESERVED 1<<1
 #define MMAP_ENTRY_TYPE_ACPI_RECLAIMABLE 1<<2
@@ -17,9 +31,56 @@ typedef struct
     uint8_t type;
 } memory_map_entry_t;
 
+typedef enum
+{
+    PMM_ZONE_DMA16 = 0,  // below 16 MiB, for isa dma
+    PMM_ZONE_DMA32 = 1,  // below 4 GiB, for 32 bit dma
+    PMM_ZONE_NORMAL = 2, // everything else
+    PMM_NUM_ZONES = 3
+} pmm_zone_t;
+
+typedef struct
+{
+    size_t pooled;
+    uint64_t hits;
+    uint64_t misses;
+} pmm_zero_pool_stats_t;
+
 int pmm_init(memory_map_entry_t *memory_map, uint64_t num_mmap_entries, uint64_t total_memory);
 void *pmm_alloc(void);
-void pmm_free(uint64_t *page);
+void pmm_free(uint64_t *page); // drops a reference, the page is only freed once the last one is gone
+
+// single pages can be shared, every pmm_ref needs a matching pmm_free
+int pmm_ref(void *page);
+uint32_t pmm_get_refs(void *page);
+
+// allocates 2^order physically contiguous pages, aligned to their size
+void *pmm_alloc_pages(uint8_t order);
+void pmm_free_pages(void *addr, uint8_t order);
+
+// allocate from the given zone, falling back to lower ones; pmm_alloc and pmm_alloc_pages use PMM_ZONE_NORMAL
+void *pmm_alloc_zone(pmm_zone_t zone);
+void *pmm_alloc_pages_zone(pmm_zone_t zone, uint8_t order);
+
+// until this is called only memory identity mapped by the bootstrap page tables is handed out
+void pmm_set_mapped_limit(uint64_t addr);
+
+// shrinkers are called when an allocation fails and return the number of pages they gave back
+int pmm_register_shrinker(size_t (*shrink)(void));
+
+// hands MMAP_ENTRY_TYPE_ACPI_RECLAIMABLE memory to the allocator, call once the acpi tables aren't needed anymore
+void pmm_reclaim_acpi_memory(void);
+
+// batch must be between 1 and PMM_MAGAZINE_SIZE / 2
+int pmm_set_magazine_batch(size_t batch);
+
+void *pmm_alloc_zeroed(void);
+void pmm_refill_zero_pool(size_t budget);
+void pmm_zero_pool_init(void); // needs the pit
+void pmm_get_zero_pool_stats(pmm_zero_pool_stats_t *stats);
+
+uint64_t pmm_get_free_pages(void);
+uint64_t pmm_get_zone_free_pages(pmm_zone_t zone);
 
 uint64_t get_max_addr(void);
 
@@ -6,6 +6,7 @@
 
 #include <kernel/status.h>
 #include <kernel/fs/vfs.h>
+#include <kernel/fs/page_cache.h>
 
 #define PF_X 0x01
 #define PF_W 0x02
@@ -129,16 +130,19 @@ typedef struct
 
 typedef struct
 {
-    void *file_content;
+    Elf64_Ehdr header;
+    Elf64_Phdr *phdrs; // header.e_phnum entries
     file_node_t *node;
+    page_cache_t *cache; // read-only segments map its pages, so every process running the file shares them
+    size_t refs;
 } elf_file_t;
 
 struct _process;
 
 uint64_t elf_entry(elf_file_t *file);
 elf_file_t *elf_load(const char *path);
-void elf_free(elf_file_t *file);
-int elf_load_and_map(struct _process *proc, elf_file_t *elf_file);
-int elf_load_and_map_copy(struct _process *proc, elf_file_t *elf_file, struct _process *original); // copys the data sections (useful for forking)
+elf_file_t *elf_ref(elf_file_t *file); // processes forked from each other share the file
+void elf_free(elf_file_t *file);        // drops a reference
+int elf_map_segments(struct _process *proc, elf_file_t *elf_file); // adds areas for every loadable segment, the pages are read on the first access
 
 #endif
\ No newline at end of file
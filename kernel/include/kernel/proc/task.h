@@ -8,20 +8,24 @@
 #include <kernel/vmm.h>
 #include <kernel/proc/elf.h>
 #include <kernel/proc/stream.h>
+#include <kernel/proc/vma.h>
 
 /*
  kernel:  0x100000
- heap:    0x200000
  process: 0x400000
  stack:   0x800000
+ heap:    0x40000000 - 0x7f0000000000
 */
 
 #define PROCESS_VADDR 0x400000
 
 #define PROCESS_STACK_VADDR_BASE 0x800000
-#define PROCESS_STACK_SIZE 4096 * 3
+#define PROCESS_STACK_SIZE 4096 * 3      // initial size, mapped on demand
+#define PROCESS_STACK_MAX_SIZE 0x100000 // faults below the stack grow it up to this size
 
-#define PROCESS_HEAP_VADDR_BASE 0x200000
+// mmap places areas here, above the first GiB that holds the kernel image, the program and the stack
+#define PROCESS_HEAP_VADDR_BASE 0x40000000
+#define PROCESS_HEAP_VADDR_END 0x7f0000000000
 
 #define PROCESS_MAX_STREAMS 128
 
@@ -37,8 +41,6 @@ struct _process;
 typedef struct _task
 {
     struct _process *parent;
-    void **stack_pages; // physical addresses
-    size_t num_stack_pages;
     task_state_t state;
 } task_t;
 
@@ -49,8 +51,7 @@ typedef struct _process
 
     char path[MAX_PATH];
     page_table_t *pml4;
-    void **data_pages; // physical addresses
-    size_t num_data_pages;
+    vma_t *vmas;
 
     stream_t streams[PROCESS_MAX_STREAMS];
 
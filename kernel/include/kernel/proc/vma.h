@@ -0,0 +1,63 @@
+#ifndef _KERNEL_VMA_H
+#define _KERNEL_VMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <kernel/status.h>
+#include <kernel/fs/vfs.h>
+#include <kernel/fs/page_cache.h>
+
+#define VMA_GROWS_DOWN 0x1 // the stack, faults right below the area extend it
+#define VMA_SHARED 0x2     // writes go to the page cache instead of a private copy
+
+// mmap protection and flags, shared with libhydra
+#define MMAP_PROT_NONE 0x0
+#define MMAP_PROT_READ 0x1
+#define MMAP_PROT_WRITE 0x2
+#define MMAP_PROT_EXEC 0x4
+
+#define MMAP_PRIVATE 0x1
+#define MMAP_SHARED 0x2
+#define MMAP_FIXED 0x4
+#define MMAP_ANONYMOUS 0x8
+
+/*
+ a virtual memory area describes a page aligned range of a process that is mapped lazily on the first access.
+ [file_start, file_end) is read from the file at file_offset, the rest of the area is zero filled.
+ areas with a page cache but no file map its pages directly instead, file_offset then has to be page aligned.
+ with both, the file content is copied out of the cache instead of being read page by page.
+*/
+typedef struct vma
+{
+    uintptr_t start;
+    uintptr_t end; // exclusive
+    uint64_t page_flags;
+    uint8_t flags;
+
+    file_node_t *file; // NULL for anonymous memory, owned by whoever created the area
+    page_cache_t *cache; // the area holds a reference
+    uint64_t file_offset;
+    uintptr_t file_start;
+    uintptr_t file_end;
+
+    struct vma *next; // sorted by address
+} vma_t;
+
+struct _process;
+
+vma_t *vma_create(uintptr_t start, uintptr_t end, uint64_t page_flags, uint8_t flags);
+void vma_free(vma_t *vma); // the area must not be in a list anymore, doesn't touch its pages
+int vma_insert(struct _process *proc, vma_t *vma); // fails if the area overlaps another one
+vma_t *vma_find(struct _process *proc, uintptr_t addr);
+uintptr_t vma_find_free(struct _process *proc, size_t size); // first gap of the heap region that fits size, 0 if there is none
+
+int vma_unmap(struct _process *proc, uintptr_t start, uintptr_t end);                       // splits areas that are only partly covered
+int vma_protect(struct _process *proc, uintptr_t start, uintptr_t end, uint64_t page_flags); // fails unless the whole range is mapped
+
+int vma_fault(struct _process *proc, uintptr_t addr, bool write);   // maps the page containing addr or breaks its copy on write sharing, succeeds if there is nothing to do
+int vma_clone_all(struct _process *proc, struct _process *original); // copies the areas and shares their pages copy on write
+void vma_free_all(struct _process *proc);                           // unmaps and frees the pages of every area
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef _KERNEL_SLAB_H
+#define _KERNEL_SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <kernel/status.h>
+
+typedef struct kmem_cache kmem_cache_t;
+
+typedef struct
+{
+    size_t object_size; // after alignment
+    size_t objects_per_slab;
+    size_t slab_pages;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t active_objects;
+    uint64_t total_objects;
+    uint64_t slabs;
+    uint64_t slabs_created;
+    uint64_t slabs_destroyed;
+} kmem_cache_stats_t;
+
+/*
+ ctor is called once for every object when its slab is created, not on every allocation.
+ objects have to be handed back to kmem_cache_free in their constructed state.
+*/
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *obj));
+int kmem_cache_destroy(kmem_cache_t *cache); // fails if objects are still allocated
+
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+size_t kmem_cache_shrink(kmem_cache_t *cache); // returns the number of pages given back to the pmm
+int kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *stats);
+
+#endif
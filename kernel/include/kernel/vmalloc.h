@@ -0,0 +1,18 @@
+#ifndef _KERNEL_VMALLOC_H
+#define _KERNEL_VMALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <kernel/status.h>
+#include <kernel/vmm.h>
+
+// virtually contiguous allocations made of single pmm pages, for buffers too large for the heap
+#define VMALLOC_START 0xFFFFD00000000000
+#define VMALLOC_SIZE 0x1000000000 // 64 GiB
+
+int vmalloc_init(page_table_t *kernel_pml4);
+void *vmalloc(size_t size);
+void vfree(void *ptr);
+
+#endif
@@ -17,19 +17,57 @@
 #define PAGE_GLOBAL 0x100                // Global Page
 #define PAGE_NO_EXECUTE 0x80000000000000 // No Execute (NX) bit
 
+#define PAGE_ADDRESS_MASK 0x000FFFFFFFFFF000
+#define PAGE_SIZE_2M 0x200000UL
+#define PAGE_SIZE_1G 0x40000000UL
+#define PAGE_SIZE_512G 0x8000000000UL // covered by one pml4 entry
+
+#define KERNEL_SPACE_START 0xFFFF800000000000
+
 typedef struct page_table
 {
     uint64_t entries[512];
 } page_table_t;
 
+/*
+ every address space shares the page tables of the kernel image and the pml4 entries of the kernel ranges
+ registered with vmm_share_kernel_range, so kernel mappings made there show up everywhere.
+ ranges have to be registered before the first address space is created.
+*/
+int vmm_init(page_table_t *kernel_pml4);
+int vmm_share_kernel_range(void *start, size_t size);
+page_table_t *pml4_create(void);
+
 // WARNING: the pml4 must always be page aligned
 // pml is the virtual address to the pml4
 int pml4_map(page_table_t *pml4, void *virt, void *phys, uint64_t flags);
-int pml4_map_range(page_table_t *pml4, void *virt, void *phys, size_t num, uint64_t flags);
+int pml4_map_huge(page_table_t *pml4, void *virt, void *phys, size_t page_size, uint64_t flags); // page_size is PAGE_SIZE, PAGE_SIZE_2M or PAGE_SIZE_1G
+int pml4_map_range(page_table_t *pml4, void *virt, void *phys, size_t num, uint64_t flags);      // num pages, uses the largest page size the alignment allows
+int pml4_map_pages(page_table_t *pml4, void *virt, void **pages, size_t num, uint64_t flags);     // maps num pages from an array of physical pages
+int pml4_unmap(page_table_t *pml4, void *virt);                                                   // doesn't free the page or the page tables, splits huge pages
+int pml4_unmap_range(page_table_t *pml4, void *virt, size_t num);                                 // skips holes and frees page tables that end up empty
+int pml4_release_range(page_table_t *pml4, void *virt, size_t num);                               // like pml4_unmap_range, but also pmm_frees every page it unmaps, no huge pages
+int pml4_protect_range(page_table_t *pml4, void *virt, size_t num, uint64_t flags);              // replaces the flags of every present page
+int pml4_share_range(page_table_t *dst, page_table_t *src, void *virt, size_t num, uint64_t flags); // maps the present pages of src into dst too, gives both the flags and takes a pmm reference per page
 uint64_t pml4_get_phys(page_table_t *pml4, void *virt, bool user);
+uint64_t pml4_get_flags(page_table_t *pml4, void *virt); // 0 if virt isn't mapped
+
+typedef struct
+{
+    size_t page_tables;           // pages currently used as page tables
+    uint64_t destroyed;           // address spaces torn down by pml4_destroy
+    uint64_t reclaimed_tables;    // page tables freed by all of them
+    size_t last_reclaimed_tables; // page tables freed by the most recent one, so by the last process exit
+} vmm_stats_t;
+
+size_t pml4_destroy(page_table_t *pml4); // frees every page table that isn't shared, not the mapped pages, returns the number of tables freed
+size_t vmm_get_num_page_tables(void);
+void vmm_get_stats(vmm_stats_t *stats);
 
 // WARNING: pml4 needs to be a physical address
+// doesn't flush the tlb when the cpu supports pcids
 int pml4_switch(page_table_t *pml4);
+page_table_t *pml4_get_current(void);
 
 void *page_align_address_lower(void *addr);
 void *page_align_address_higer(void *addr);
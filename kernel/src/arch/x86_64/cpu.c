@@ -0,0 +1,60 @@
+#include <kernel/cpu.h>
+
+uint32_t cpu_get_id(void)
+{
+    return 0;
+}
+
+static void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    __asm__ volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+bool cpu_has_1gb_pages(void)
+{
+    static int supported = -1;
+    if (supported < 0)
+    {
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+        supported = 0;
+        if (eax >= 0x80000001)
+        {
+            cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+            supported = (edx >> 26) & 1; // pdpe1gb
+        }
+    }
+
+    return supported;
+}
+
+bool cpu_has_pcid(void)
+{
+    static int supported = -1;
+    if (supported < 0)
+    {
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(1, &eax, &ebx, &ecx, &edx);
+        supported = (ecx >> 17) & 1;
+    }
+
+    return supported;
+}
+
+bool cpu_has_invpcid(void)
+{
+    static int supported = -1;
+    if (supported < 0)
+    {
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(0, &eax, &ebx, &ecx, &edx);
+        supported = 0;
+        if (eax >= 7)
+        {
+            cpuid(7, &eax, &ebx, &ecx, &edx);
+            supported = (ebx >> 10) & 1;
+        }
+    }
+
+    return supported;
+}
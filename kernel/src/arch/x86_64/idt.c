@@ -110,6 +110,7 @@ extern page_table_t *kernel_pml4;
 
 void irq_handler(interrupt_frame_t *frame)
 {
+    page_table_t *interrupted_pml4 = pml4_get_current();
     if (pml4_switch(kernel_pml4) < 0)
     {
         KPANIC("failed to switch pml4");
@@ -126,13 +127,8 @@ void irq_handler(interrupt_frame_t *frame)
         interrupt_handlers[frame->int_no](frame);
     }
 
-    process_t *proc = get_current_process();
-    if (!proc)
-    {
-        return;
-    }
-
-    if (pml4_switch(proc->pml4) < 0)
+    // doesn't touch cr3 if the interrupt came from the kernel
+    if (pml4_switch(interrupted_pml4) < 0)
     {
         KPANIC("failed to switch pml4");
     }
@@ -168,13 +164,48 @@ char *exception_names[] = {
     "Reserved",
 };
 
+// resolves faults on pages of the current process that haven't been mapped yet or are shared copy on write
+static bool handle_page_fault(interrupt_frame_t *frame)
+{
+    if (!(frame->err_code & 0b100) || (frame->err_code & 0b1000))
+    {
+        return false; // kernel faults and reserved bits are fatal
+    }
+
+    if ((frame->err_code & 0b1) && !(frame->err_code & 0b10))
+    {
+        return false; // only writes can resolve a protection violation
+    }
+
+    process_t *proc = get_current_process();
+    if (!proc)
+    {
+        return false;
+    }
+
+    uint64_t cr2_val;
+    __asm__ volatile("movq %%cr2, %0" : "=r"(cr2_val));
+
+    return vma_fault(proc, cr2_val, (frame->err_code & 0b10) != 0) == 0;
+}
+
 void exception_handler(interrupt_frame_t *frame)
 {
+    page_table_t *interrupted_pml4 = pml4_get_current();
     if (pml4_switch(kernel_pml4) < 0)
     {
         KPANIC("failed to switch pml4");
     }
 
+    if (frame->int_no == 14 && handle_page_fault(frame))
+    {
+        if (pml4_switch(interrupted_pml4) < 0)
+        {
+            KPANIC("failed to switch pml4");
+        }
+        return;
+    }
+
     kprintf("\x1b[41mCPU exception triggered\n\n[Exception Info]\nType: %s\n", exception_names[frame->int_no]);
     switch (frame->int_no)
     {
@@ -1,77 +1,441 @@
 #include <kernel/vmm.h>
+#include <kernel/cpu.h>
 #include <kernel/string.h>
 
+extern int __kernel_start;
+extern int __kernel_end;
+
 page_table_t *current_page_table = NULL;
 
+static page_table_t *kernel_space = NULL;
+static page_table_t *kernel_image_pd = NULL; // template for the lowest pd of every address space
+static uint64_t shared_entries[512 / 64];   // pml4 entries linked into every address space
+
 static inline void flush_tlb(void *addr)
 {
     __asm__ volatile("invlpg (%0)" ::"r"(addr) : "memory");
 }
 
-int pml4_map(page_table_t *pml4, void *virt, void *phys, uint64_t flags)
+// drops every non global entry of the current address space
+static inline void flush_tlb_all(void)
 {
-    if ((uintptr_t)virt % PAGE_SIZE != 0 || (uintptr_t)phys % PAGE_SIZE != 0)
+    uint64_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+/*
+ with pcids the tlb keeps the entries of address spaces that aren't loaded, so switching doesn't flush.
+ pcid 0 belongs to the kernel address space, the others are handed out round robin.
+ pages changed while their address space isn't loaded are dropped right away with invpcid, or queued and
+ dropped with invlpg right after the next switch to it. only if too many pile up, or the shared upper half
+ changed, is the address space marked stale and flushed as a whole on the next switch.
+*/
+#define MAX_PCIDS 64
+#define PCID_MAX_PENDING 16
+#define CR3_NO_FLUSH (1UL << 63)
+#define CR4_PGE (1UL << 7)
+#define CR4_PCIDE (1UL << 17)
+#define INVPCID_ADDRESS 0
+
+typedef struct
+{
+    page_table_t *pml4;
+    bool stale;
+    uintptr_t pending[PCID_MAX_PENDING];
+    size_t num_pending;
+} pcid_slot_t;
+
+static pcid_slot_t pcids[MAX_PCIDS];
+static uint16_t next_pcid = 1;
+static bool pcid_enabled = false;
+static bool invpcid_enabled = false;
+
+static inline void invpcid(uint64_t pcid, uintptr_t addr)
+{
+    struct
     {
-        return -EINVARG;
+        uint64_t pcid;
+        uint64_t addr;
+    } descriptor = {pcid, addr};
+
+    __asm__ volatile("invpcid %0, %1" ::"m"(descriptor), "r"((uint64_t)INVPCID_ADDRESS) : "memory");
+}
+
+static void pcid_mark_stale(pcid_slot_t *slot)
+{
+    slot->stale = true;
+    slot->num_pending = 0;
+}
+
+// pages were changed in pml4 while it isn't loaded, more than PCID_MAX_PENDING always flush everything
+static void pcid_invalidate(page_table_t *pml4, const uintptr_t *pages, size_t count, bool shared)
+{
+    if (!pcid_enabled)
+    {
+        return;
+    }
+
+    for (uint64_t i = 0; i < MAX_PCIDS; i++)
+    {
+        pcid_slot_t *slot = &pcids[i];
+        if (!slot->pml4 || slot->pml4 == current_page_table || slot->stale)
+        {
+            continue;
+        }
+
+        // shared means the upper half changed, which every address space might have cached
+        if (shared || count > PCID_MAX_PENDING)
+        {
+            if (shared || slot->pml4 == pml4)
+            {
+                pcid_mark_stale(slot);
+            }
+            continue;
+        }
+
+        if (slot->pml4 != pml4)
+        {
+            continue;
+        }
+
+        for (size_t j = 0; j < count; j++)
+        {
+            if (invpcid_enabled)
+            {
+                invpcid(i, pages[j]);
+            }
+            else if (slot->num_pending == PCID_MAX_PENDING)
+            {
+                pcid_mark_stale(slot);
+                break;
+            }
+            else
+            {
+                slot->pending[slot->num_pending++] = pages[j];
+            }
+        }
+    }
+}
+
+static void invalidate_page(page_table_t *pml4, void *virt)
+{
+    if (current_page_table == pml4)
+    {
+        flush_tlb(virt);
     }
 
-    uint64_t virt_addr = (uint64_t)virt;
-    uint64_t phys_addr = (uint64_t)phys;
+    uintptr_t page = (uintptr_t)virt;
+    pcid_invalidate(pml4, &page, 1, page >= KERNEL_SPACE_START);
+}
+
+/*
+ range operations collect the pages they changed and invalidate them in one go at the end.
+ past TLB_BATCH_MAX pages a single cr3 reload is cheaper than that many invlpgs.
+*/
+#define TLB_BATCH_MAX 32
 
-    uint16_t pml4_index = (virt_addr >> 39) & 0x1FF;
-    uint16_t pdpt_index = (virt_addr >> 30) & 0x1FF;
-    uint16_t pd_index = (virt_addr >> 21) & 0x1FF;
-    uint16_t pt_index = (virt_addr >> 12) & 0x1FF;
+typedef struct
+{
+    page_table_t *pml4;
+    uintptr_t pages[TLB_BATCH_MAX];
+    size_t count;
+    bool shared;
+} tlb_batch_t;
 
-    uint64_t entry = pml4->entries[pml4_index];
-    page_table_t *pdpt = (page_table_t *)(entry & ~0xFFF);
-    if ((entry & PAGE_PRESENT) != PAGE_PRESENT)
+static void tlb_batch_add(tlb_batch_t *batch, uintptr_t virt)
+{
+    if (batch->count < TLB_BATCH_MAX)
+    {
+        batch->pages[batch->count] = virt;
+    }
+    batch->count++;
+
+    if (virt >= KERNEL_SPACE_START)
+    {
+        batch->shared = true;
+    }
+}
+
+static void tlb_batch_flush(tlb_batch_t *batch)
+{
+    if (batch->count == 0)
     {
-        pdpt = (page_table_t *)pmm_alloc();
-        if (!pdpt)
+        return;
+    }
+
+    if (current_page_table == batch->pml4)
+    {
+        if (batch->count > TLB_BATCH_MAX)
         {
-            return -ENOMEM;
+            flush_tlb_all();
+        }
+        else
+        {
+            for (size_t i = 0; i < batch->count; i++)
+            {
+                flush_tlb((void *)batch->pages[i]);
+            }
         }
-        memset(pdpt, 0, PAGE_SIZE);
-        pml4->entries[pml4_index] = (uint64_t)pdpt | (PAGE_PRESENT | PAGE_USER | PAGE_WRITABLE);
     }
 
-    entry = pdpt->entries[pdpt_index];
-    page_table_t *pd = (page_table_t *)(entry & ~0xFFF);
-    if ((entry & PAGE_PRESENT) != PAGE_PRESENT)
+    pcid_invalidate(batch->pml4, batch->pages, batch->count, batch->shared);
+    batch->count = 0;
+    batch->shared = false;
+}
+
+static uint64_t pcid_cr3(page_table_t *pml4)
+{
+    uint16_t pcid = 0;
+    if (pml4 != kernel_space)
     {
-        pd = (page_table_t *)pmm_alloc();
-        if (!pd)
+        for (pcid = 1; pcid < MAX_PCIDS && pcids[pcid].pml4 != pml4; pcid++)
+            ;
+
+        if (pcid == MAX_PCIDS)
         {
-            return -ENOMEM;
+            pcid = next_pcid;
+            next_pcid = next_pcid % (MAX_PCIDS - 1) + 1;
+            pcids[pcid].pml4 = pml4;
+            pcid_mark_stale(&pcids[pcid]); // may still hold entries of the previous owner
+        }
+    }
+
+    uint64_t cr3 = (uint64_t)pml4 | pcid;
+    if (!pcids[pcid].stale)
+    {
+        cr3 |= CR3_NO_FLUSH;
+    }
+    pcids[pcid].stale = false;
+
+    return cr3;
+}
+
+// has to run right after the cr3 of the pcid was loaded, invlpg only affects the current pcid
+static void pcid_flush_pending(uint16_t pcid)
+{
+    pcid_slot_t *slot = &pcids[pcid];
+    for (size_t i = 0; i < slot->num_pending; i++)
+    {
+        flush_tlb((void *)slot->pending[i]);
+    }
+    slot->num_pending = 0;
+}
+
+static page_table_t *entry_table(uint64_t entry)
+{
+    return (page_table_t *)(entry & PAGE_ADDRESS_MASK);
+}
+
+static size_t num_page_tables = 0;
+static uint64_t destroyed_spaces = 0;
+static uint64_t reclaimed_tables = 0;
+static size_t last_reclaimed_tables = 0;
+
+static page_table_t *alloc_table(bool zero)
+{
+    page_table_t *table = (page_table_t *)(zero ? pmm_alloc_zeroed() : pmm_alloc());
+    if (table)
+    {
+        num_page_tables++;
+    }
+
+    return table;
+}
+
+static void free_table(page_table_t *table)
+{
+    pmm_free((uint64_t *)table);
+    num_page_tables--;
+}
+
+static bool table_empty(page_table_t *table)
+{
+    for (size_t i = 0; i < 512; i++)
+    {
+        if (table->entries[i] != 0)
+        {
+            return false;
         }
-        memset(pd, 0, PAGE_SIZE);
-        pdpt->entries[pdpt_index] = (uint64_t)pd | (PAGE_PRESENT | PAGE_USER | PAGE_WRITABLE);
     }
 
-    entry = pd->entries[pd_index];
-    page_table_t *pt = (page_table_t *)(entry & ~0xFFF);
+    return true;
+}
+
+static bool is_shared_table(page_table_t *table, uint16_t index, size_t entry_size)
+{
+    if (table == kernel_space)
+    {
+        return true;
+    }
+
+    // every address space links the same pdpts in the upper half and the same page tables for the kernel image
+    return (entry_size == PAGE_SIZE_512G && (shared_entries[index / 64] & (1UL << (index % 64)))) ||
+           (entry_size == PAGE_SIZE_2M && kernel_image_pd && table->entries[index] == kernel_image_pd->entries[index]);
+}
+
+// replaces a huge page with a table of 512 pages of the next smaller size, the translation stays the same
+static page_table_t *split_huge_page(page_table_t *table, uint16_t index, size_t entry_size)
+{
+    page_table_t *next = alloc_table(false);
+    if (!next)
+    {
+        return NULL;
+    }
+
+    uint64_t entry = table->entries[index];
+    uint64_t phys = entry & PAGE_ADDRESS_MASK & ~(uint64_t)(entry_size - 1);
+    uint64_t flags = entry & ~PAGE_ADDRESS_MASK;
+    size_t child_size = entry_size / 512;
+    if (child_size == PAGE_SIZE)
+    {
+        flags &= ~PAGE_HUGE; // the same bit is PAT in a page table entry
+    }
+
+    for (size_t i = 0; i < 512; i++)
+    {
+        next->entries[i] = (phys + i * child_size) | flags;
+    }
+
+    table->entries[index] = (uint64_t)next | (PAGE_PRESENT | PAGE_USER | PAGE_WRITABLE);
+    return next;
+}
+
+// entry_size is the size of the memory one entry of table covers
+static page_table_t *get_next_table(page_table_t *table, uint16_t index, size_t entry_size, bool create)
+{
+    uint64_t entry = table->entries[index];
     if ((entry & PAGE_PRESENT) != PAGE_PRESENT)
     {
-        pt = (page_table_t *)pmm_alloc();
-        if (!pt)
+        if (!create)
+        {
+            return NULL;
+        }
+
+        page_table_t *next = alloc_table(true);
+        if (!next)
+        {
+            return NULL;
+        }
+        table->entries[index] = (uint64_t)next | (PAGE_PRESENT | PAGE_USER | PAGE_WRITABLE);
+        return next;
+    }
+
+    if ((entry & PAGE_HUGE) == PAGE_HUGE)
+    {
+        return split_huge_page(table, index, entry_size);
+    }
+
+    return entry_table(entry);
+}
+
+static uint8_t page_shift(size_t page_size)
+{
+    uint8_t shift = 12;
+    while (((size_t)1 << shift) < page_size)
+    {
+        shift += 9;
+    }
+
+    return shift;
+}
+
+// finds the table holding the entries for pages of page_size, huge pages above that level get split
+static int walk(page_table_t *pml4, uintptr_t virt, size_t page_size, bool create, page_table_t **res)
+{
+    page_table_t *table = pml4;
+    size_t entry_size = PAGE_SIZE_512G;
+    while (entry_size > page_size)
+    {
+        uint16_t index = (virt >> page_shift(entry_size)) & 0x1FF;
+        if ((table->entries[index] & PAGE_PRESENT) != PAGE_PRESENT && !create)
+        {
+            *res = NULL;
+            return 0;
+        }
+
+        table = get_next_table(table, index, entry_size, create);
+        if (!table)
         {
             return -ENOMEM;
         }
-        memset(pt, 0, PAGE_SIZE);
-        pd->entries[pd_index] = (uint64_t)pt | (PAGE_PRESENT | PAGE_USER | PAGE_WRITABLE);
+
+        entry_size /= 512;
     }
 
-    pt->entries[pt_index] = phys_addr | flags;
+    *res = table;
+    return 0;
+}
 
-    if (current_page_table == pml4)
+static uint64_t leaf_entry(uint64_t phys, size_t page_size, uint64_t flags)
+{
+    // the huge bit is PAT in a page table entry
+    return page_size == PAGE_SIZE ? phys | (flags & ~PAGE_HUGE) : phys | flags | PAGE_HUGE;
+}
+
+int pml4_map(page_table_t *pml4, void *virt, void *phys, uint64_t flags)
+{
+    return pml4_map_huge(pml4, virt, phys, PAGE_SIZE, flags);
+}
+
+int pml4_map_huge(page_table_t *pml4, void *virt, void *phys, size_t page_size, uint64_t flags)
+{
+    if (page_size != PAGE_SIZE && page_size != PAGE_SIZE_2M && (page_size != PAGE_SIZE_1G || !cpu_has_1gb_pages()))
     {
-        flush_tlb(virt);
+        return -EINVARG;
+    }
+
+    if ((uintptr_t)virt % page_size != 0 || (uintptr_t)phys % page_size != 0)
+    {
+        return -EINVARG;
+    }
+
+    page_table_t *table;
+    int status = walk(pml4, (uintptr_t)virt, page_size, true, &table);
+    if (status < 0)
+    {
+        return status;
+    }
+
+    uint16_t index = ((uintptr_t)virt >> page_shift(page_size)) & 0x1FF;
+    uint64_t entry = table->entries[index];
+
+    // a huge page would orphan the page table that is already there
+    if (page_size != PAGE_SIZE && (entry & PAGE_PRESENT) == PAGE_PRESENT && (entry & PAGE_HUGE) != PAGE_HUGE)
+    {
+        return -EINVARG;
+    }
+
+    table->entries[index] = leaf_entry((uint64_t)phys, page_size, flags);
+
+    if ((entry & PAGE_PRESENT) == PAGE_PRESENT)
+    {
+        invalidate_page(pml4, virt);
     }
 
     return 0;
 }
 
+static size_t largest_page_size(uintptr_t virt, uintptr_t phys, size_t remaining)
+{
+    if ((virt | phys) % PAGE_SIZE_1G == 0 && remaining >= PAGE_SIZE_1G && cpu_has_1gb_pages())
+    {
+        return PAGE_SIZE_1G;
+    }
+
+    if ((virt | phys) % PAGE_SIZE_2M == 0 && remaining >= PAGE_SIZE_2M)
+    {
+        return PAGE_SIZE_2M;
+    }
+
+    return PAGE_SIZE;
+}
+
+static bool is_table(uint64_t entry, size_t page_size)
+{
+    return page_size != PAGE_SIZE && (entry & PAGE_PRESENT) == PAGE_PRESENT && (entry & PAGE_HUGE) != PAGE_HUGE;
+}
+
 int pml4_map_range(page_table_t *pml4, void *virt, void *phys, size_t num, uint64_t flags)
 {
     if ((uintptr_t)virt % PAGE_SIZE != 0 || (uintptr_t)phys % PAGE_SIZE != 0)
@@ -79,71 +443,502 @@ int pml4_map_range(page_table_t *pml4, void *virt, void *phys, size_t num, uint6
         return -EINVARG;
     }
 
-    for (uintptr_t i = 0; i < num; i++)
+    tlb_batch_t batch = {.pml4 = pml4};
+    uintptr_t virt_addr = (uintptr_t)virt;
+    uintptr_t phys_addr = (uintptr_t)phys;
+    size_t remaining = num * PAGE_SIZE;
+    int status = 0;
+    while (remaining > 0)
+    {
+        size_t page_size = largest_page_size(virt_addr, phys_addr, remaining);
+
+        page_table_t *table;
+        uint16_t index;
+        for (;;)
+        {
+            status = walk(pml4, virt_addr, page_size, true, &table);
+            if (status < 0)
+            {
+                break;
+            }
+
+            index = (virt_addr >> page_shift(page_size)) & 0x1FF;
+            if (!is_table(table->entries[index], page_size))
+            {
+                break;
+            }
+            page_size /= 512; // already mapped with smaller pages
+        }
+
+        if (status < 0)
+        {
+            break;
+        }
+
+        // fill the rest of the table, the next table might allow a larger page size again
+        while (index < 512 && remaining >= page_size && !is_table(table->entries[index], page_size))
+        {
+            if ((table->entries[index] & PAGE_PRESENT) == PAGE_PRESENT)
+            {
+                tlb_batch_add(&batch, virt_addr);
+            }
+            table->entries[index] = leaf_entry(phys_addr, page_size, flags);
+
+            index++;
+            virt_addr += page_size;
+            phys_addr += page_size;
+            remaining -= page_size;
+        }
+    }
+
+    tlb_batch_flush(&batch);
+    return status;
+}
+
+int pml4_map_pages(page_table_t *pml4, void *virt, void **pages, size_t num, uint64_t flags)
+{
+    if ((uintptr_t)virt % PAGE_SIZE != 0)
+    {
+        return -EINVARG;
+    }
+
+    tlb_batch_t batch = {.pml4 = pml4};
+    uintptr_t virt_addr = (uintptr_t)virt;
+    size_t i = 0;
+    int status = 0;
+    while (i < num)
+    {
+        page_table_t *pt;
+        status = walk(pml4, virt_addr, PAGE_SIZE, true, &pt);
+        if (status < 0)
+        {
+            break;
+        }
+
+        for (uint16_t index = (virt_addr >> 12) & 0x1FF; index < 512 && i < num; index++, i++)
+        {
+            if ((pt->entries[index] & PAGE_PRESENT) == PAGE_PRESENT)
+            {
+                tlb_batch_add(&batch, virt_addr);
+            }
+            pt->entries[index] = leaf_entry((uint64_t)pages[i], PAGE_SIZE, flags);
+            virt_addr += PAGE_SIZE;
+        }
+    }
+
+    tlb_batch_flush(&batch);
+    return status;
+}
+
+/*
+ sets the flags of every present page in the range, or clears the entries if unmap is set.
+ release also drops the pmm reference of every page it unmaps, so only present pages cost anything.
+ with share set the pages are also mapped there with the same flags, each one gaining a pmm reference.
+*/
+static int update_range(page_table_t *pml4, uintptr_t virt, size_t num, bool unmap, bool release, uint64_t flags, page_table_t *share)
+{
+    if (virt % PAGE_SIZE != 0)
+    {
+        return -EINVARG;
+    }
+
+    tlb_batch_t batch = {.pml4 = pml4};
+    uintptr_t end = virt + num * PAGE_SIZE;
+    int status = 0;
+    while (virt < end)
     {
-        int status = pml4_map(pml4, (void *)((uintptr_t)virt + i * PAGE_SIZE), (void *)((uintptr_t)phys + i * PAGE_SIZE), flags);
+        // go down until a leaf, a hole, or a huge page the range covers completely
+        page_table_t *parent = NULL;
+        uint16_t parent_index = 0;
+        page_table_t *table = pml4;
+        size_t entry_size = PAGE_SIZE_512G;
+        uint16_t index = 0;
+        uint64_t entry = 0;
+        for (;;)
+        {
+            index = (virt >> page_shift(entry_size)) & 0x1FF;
+            entry = table->entries[index];
+
+            if ((entry & PAGE_PRESENT) != PAGE_PRESENT || entry_size == PAGE_SIZE)
+            {
+                break;
+            }
+
+            if ((entry & PAGE_HUGE) == PAGE_HUGE && virt % entry_size == 0 && end - virt >= entry_size)
+            {
+                break;
+            }
+
+            parent = table;
+            parent_index = index;
+            table = get_next_table(table, index, entry_size, false);
+            if (!table)
+            {
+                status = -ENOMEM;
+                break;
+            }
+            entry_size /= 512;
+        }
+
+        if (status < 0)
+        {
+            break;
+        }
+
+        if ((entry & PAGE_PRESENT) != PAGE_PRESENT && entry_size != PAGE_SIZE)
+        {
+            virt = (virt & ~(uintptr_t)(entry_size - 1)) + entry_size; // nothing mapped below this entry
+            continue;
+        }
+
+        if (release && entry_size != PAGE_SIZE)
+        {
+            status = -EINVARG; // huge pages aren't single pmm pages
+            break;
+        }
+
+        page_table_t *share_table = NULL;
+        if (share)
+        {
+            if (entry_size != PAGE_SIZE)
+            {
+                status = -EINVARG; // only used for user space, which doesn't have huge pages
+                break;
+            }
+
+            status = walk(share, virt, PAGE_SIZE, true, &share_table);
+            if (status < 0)
+            {
+                break;
+            }
+        }
+
+        // a whole leaf table is handled in one go
+        do
+        {
+            entry = table->entries[index];
+            if ((entry & PAGE_PRESENT) == PAGE_PRESENT)
+            {
+                table->entries[index] = unmap ? 0 : leaf_entry(entry & PAGE_ADDRESS_MASK, entry_size, flags);
+                tlb_batch_add(&batch, virt);
+
+                // only this cpu runs kernel code, so nothing can use the stale tlb entry before the batch is flushed
+                if (release)
+                {
+                    pmm_free((uint64_t *)(entry & PAGE_ADDRESS_MASK));
+                }
+
+                if (share_table)
+                {
+                    status = pmm_ref((void *)(entry & PAGE_ADDRESS_MASK));
+                    if (status < 0)
+                    {
+                        break;
+                    }
+                    share_table->entries[index] = table->entries[index];
+                }
+            }
+
+            index++;
+            virt += entry_size;
+        } while (entry_size == PAGE_SIZE && index < 512 && virt < end);
+
         if (status < 0)
         {
-            return status;
+            break;
         }
+
+        // the invlpgs of the batch also drop the cached pd entry that pointed here
+        if (unmap && entry_size == PAGE_SIZE && !is_shared_table(parent, parent_index, PAGE_SIZE_2M) && table_empty(table))
+        {
+            parent->entries[parent_index] = 0;
+            free_table(table);
+            tlb_batch_add(&batch, virt - PAGE_SIZE);
+        }
+    }
+
+    tlb_batch_flush(&batch);
+    return status;
+}
+
+int pml4_unmap_range(page_table_t *pml4, void *virt, size_t num)
+{
+    return update_range(pml4, (uintptr_t)virt, num, true, false, 0, NULL);
+}
+
+int pml4_release_range(page_table_t *pml4, void *virt, size_t num)
+{
+    return update_range(pml4, (uintptr_t)virt, num, true, true, 0, NULL);
+}
+
+int pml4_protect_range(page_table_t *pml4, void *virt, size_t num, uint64_t flags)
+{
+    return update_range(pml4, (uintptr_t)virt, num, false, false, flags, NULL);
+}
+
+int pml4_share_range(page_table_t *dst, page_table_t *src, void *virt, size_t num, uint64_t flags)
+{
+    if (!dst || dst == src)
+    {
+        return -EINVARG;
+    }
+
+    return update_range(src, (uintptr_t)virt, num, false, false, flags, dst);
+}
+
+int pml4_unmap(page_table_t *pml4, void *virt)
+{
+    if ((uintptr_t)virt % PAGE_SIZE != 0)
+    {
+        return -EINVARG;
+    }
+
+    // huge pages get split, so only the one page disappears
+    page_table_t *pt;
+    int status = walk(pml4, (uintptr_t)virt, PAGE_SIZE, false, &pt);
+    if (status < 0)
+    {
+        return status;
+    }
+
+    if (!pt)
+    {
+        return -EINVARG;
     }
 
+    pt->entries[((uintptr_t)virt >> 12) & 0x1FF] = 0;
+
+    invalidate_page(pml4, virt);
+
     return 0;
 }
 
-uint64_t pml4_get_phys(page_table_t *pml4, void *virt, bool user)
+// returns the leaf entry for virt, 0 if nothing is mapped there
+static uint64_t lookup(page_table_t *pml4, uintptr_t virt, size_t *page_size)
 {
-    uint64_t virt_addr = (uint64_t)virt;
+    page_table_t *table = pml4;
+    for (size_t entry_size = PAGE_SIZE_512G;; entry_size /= 512)
+    {
+        uint64_t entry = table->entries[(virt >> page_shift(entry_size)) & 0x1FF];
+        if ((entry & PAGE_PRESENT) != PAGE_PRESENT)
+        {
+            return 0;
+        }
 
-    uint16_t pml4_index = (virt_addr >> 39) & 0x1FF;
-    uint16_t pdpt_index = (virt_addr >> 30) & 0x1FF;
-    uint16_t pd_index = (virt_addr >> 21) & 0x1FF;
-    uint16_t pt_index = (virt_addr >> 12) & 0x1FF;
+        if (entry_size == PAGE_SIZE || (entry & PAGE_HUGE) == PAGE_HUGE)
+        {
+            *page_size = entry_size;
+            return entry;
+        }
 
-    uint64_t entry = pml4->entries[pml4_index];
-    if ((entry & PAGE_PRESENT) != PAGE_PRESENT)
+        table = entry_table(entry);
+    }
+}
+
+uint64_t pml4_get_phys(page_table_t *pml4, void *virt, bool user)
+{
+    size_t page_size;
+    uint64_t entry = lookup(pml4, (uintptr_t)virt, &page_size);
+    if (entry == 0 || ((entry & PAGE_USER) != PAGE_USER && user))
     {
         return 0;
     }
 
-    page_table_t *pdpt = (page_table_t *)(entry & ~0xFFF);
-    entry = pdpt->entries[pdpt_index];
-    if ((entry & PAGE_PRESENT) != PAGE_PRESENT)
+    return (entry & PAGE_ADDRESS_MASK & ~(uint64_t)(page_size - 1)) | ((uintptr_t)virt & (page_size - 1));
+}
+
+uint64_t pml4_get_flags(page_table_t *pml4, void *virt)
+{
+    size_t page_size;
+    return lookup(pml4, (uintptr_t)virt, &page_size) & ~PAGE_ADDRESS_MASK;
+}
+
+int vmm_init(page_table_t *kernel_pml4)
+{
+    uintptr_t start = (uintptr_t)page_align_address_lower(&__kernel_start);
+    uintptr_t end = (uintptr_t)&__kernel_end;
+    if (!kernel_pml4 || end > PAGE_SIZE_1G)
     {
-        return 0;
+        return -EINVARG;
     }
 
-    page_table_t *pd = (page_table_t *)(entry & ~0xFFF);
-    entry = pd->entries[pd_index];
-    if ((entry & PAGE_PRESENT) != PAGE_PRESENT)
+    kernel_space = kernel_pml4;
+    kernel_image_pd = alloc_table(true);
+    if (!kernel_image_pd)
     {
-        return 0;
+        return -ENOMEM;
     }
 
-    page_table_t *pt = (page_table_t *)(entry & ~0xFFF);
-    entry = pt->entries[pt_index];
-    if ((entry & PAGE_PRESENT) != PAGE_PRESENT)
+    // the page tables below kernel_image_pd are shared, the pd itself can't be because user space lives next to the kernel image
+    for (uintptr_t addr = start; addr < end; addr += PAGE_SIZE)
     {
-        return 0;
+        page_table_t *pt = get_next_table(kernel_image_pd, (addr >> 21) & 0x1FF, PAGE_SIZE_2M, true);
+        if (!pt)
+        {
+            return -ENOMEM;
+        }
+        pt->entries[(addr >> 12) & 0x1FF] = addr | PAGE_PRESENT | PAGE_WRITABLE | PAGE_GLOBAL;
+    }
+
+    // the kernel image is mapped the same way everywhere, so its tlb entries can survive cr3 switches
+    uint64_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PGE;
+    if (cpu_has_pcid() && current_page_table == kernel_pml4)
+    {
+        cr4 |= CR4_PCIDE; // cr3 has to hold pcid 0 at this point
+        pcids[0].pml4 = kernel_pml4;
+        pcid_enabled = true;
+        invpcid_enabled = cpu_has_invpcid();
+    }
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+
+    return 0;
+}
+
+int vmm_share_kernel_range(void *start, size_t size)
+{
+    if (!kernel_space || (uintptr_t)start < KERNEL_SPACE_START || size == 0)
+    {
+        return -EINVARG;
+    }
+
+    uint16_t first = ((uintptr_t)start >> 39) & 0x1FF;
+    uint16_t last = (((uintptr_t)start + size - 1) >> 39) & 0x1FF;
+    for (uint16_t i = first; i <= last; i++)
+    {
+        // the entry must never change again, so the pdpt is allocated up front
+        if (!get_next_table(kernel_space, i, PAGE_SIZE_512G, true))
+        {
+            return -ENOMEM;
+        }
+        shared_entries[i / 64] |= 1UL << (i % 64);
+    }
+
+    return 0;
+}
+
+page_table_t *pml4_create(void)
+{
+    if (!kernel_space)
+    {
+        return NULL;
     }
-    if ((entry & PAGE_USER) != PAGE_USER && user)
+
+    page_table_t *pml4 = alloc_table(true);
+    page_table_t *pdpt = alloc_table(true);
+    page_table_t *pd = alloc_table(false);
+    if (!pml4 || !pdpt || !pd)
+    {
+        if (pml4)
+        {
+            free_table(pml4);
+        }
+        if (pdpt)
+        {
+            free_table(pdpt);
+        }
+        if (pd)
+        {
+            free_table(pd);
+        }
+        return NULL;
+    }
+
+    memcpy(pd, kernel_image_pd, sizeof(page_table_t));
+    pdpt->entries[0] = (uint64_t)pd | (PAGE_PRESENT | PAGE_USER | PAGE_WRITABLE);
+    pml4->entries[0] = (uint64_t)pdpt | (PAGE_PRESENT | PAGE_USER | PAGE_WRITABLE);
+
+    for (size_t i = 0; i < 512; i++)
+    {
+        if (shared_entries[i / 64] & (1UL << (i % 64)))
+        {
+            pml4->entries[i] = kernel_space->entries[i];
+        }
+    }
+
+    return pml4;
+}
+
+// frees table and every private table below it, returns the number of pages freed
+static size_t destroy_table(page_table_t *table, size_t entry_size)
+{
+    size_t res = 0;
+    for (uint16_t i = 0; i < 512 && entry_size > PAGE_SIZE; i++)
+    {
+        uint64_t entry = table->entries[i];
+        if ((entry & PAGE_PRESENT) != PAGE_PRESENT || (entry & PAGE_HUGE) == PAGE_HUGE || is_shared_table(table, i, entry_size))
+        {
+            continue;
+        }
+
+        res += destroy_table(entry_table(entry), entry_size / 512);
+    }
+
+    free_table(table);
+    return res + 1;
+}
+
+size_t pml4_destroy(page_table_t *pml4)
+{
+    if (!pml4 || pml4 == kernel_space)
     {
         return 0;
     }
 
-    uint64_t phys_addr = (entry & ~0xFFF) | (virt_addr & 0xFFF);
+    for (size_t i = 1; i < MAX_PCIDS; i++)
+    {
+        if (pcids[i].pml4 == pml4)
+        {
+            pcids[i].pml4 = NULL;
+        }
+    }
+
+    size_t freed = destroy_table(pml4, PAGE_SIZE_512G);
+    destroyed_spaces++;
+    reclaimed_tables += freed;
+    last_reclaimed_tables = freed;
+
+    return freed;
+}
 
-    return phys_addr;
+size_t vmm_get_num_page_tables(void)
+{
+    return num_page_tables;
+}
+
+void vmm_get_stats(vmm_stats_t *stats)
+{
+    stats->page_tables = num_page_tables;
+    stats->destroyed = destroyed_spaces;
+    stats->reclaimed_tables = reclaimed_tables;
+    stats->last_reclaimed_tables = last_reclaimed_tables;
 }
 
 int pml4_switch(page_table_t *pml4)
 {
+    if (pml4 == current_page_table)
+    {
+        return 0;
+    }
+
+    uint64_t cr3 = pcid_enabled ? pcid_cr3(pml4) : (uint64_t)pml4;
     current_page_table = pml4;
-    __asm__ volatile("mov %0, %%cr3" : : "r"(pml4));
+    __asm__ volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+
+    if (pcid_enabled)
+    {
+        pcid_flush_pending(cr3 & 0xFFF);
+    }
 
     return 0;
 }
 
+page_table_t *pml4_get_current(void)
+{
+    return current_page_table;
+}
+
 void *page_align_address_lower(void *addr)
 {
     uintptr_t _addr = (uintptr_t)addr;
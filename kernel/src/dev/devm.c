@@ -94,7 +94,13 @@ static int try_init_char_device(pci_device_t *pci_dev)
     {
         if (chardevs_size >= chardevs_capacity)
         {
-            chardevs = krealloc(chardevs, chardevs_capacity, chardevs_capacity + sizeof(chardev_t *) * CHARDEVS_CAPACITY_INCREASE);
+            chardev_t **new_chardevs = krealloc(chardevs, sizeof(chardev_t *) * (chardevs_capacity + CHARDEVS_CAPACITY_INCREASE));
+            if (!new_chardevs)
+            {
+                return -ENOMEM;
+            }
+
+            chardevs = new_chardevs;
             chardevs_capacity += CHARDEVS_CAPACITY_INCREASE;
         }
 
@@ -121,7 +127,13 @@ static int try_init_block_device(pci_device_t *pci_dev)
     {
         if (blockdevs_size >= blockdevs_capacity)
         {
-            blockdevs = krealloc(blockdevs, blockdevs_capacity, blockdevs_capacity + sizeof(blockdev_t *) * BLOCKDEVS_CAPACITY_INCREASE);
+            blockdev_t **new_blockdevs = krealloc(blockdevs, sizeof(blockdev_t *) * (blockdevs_capacity + BLOCKDEVS_CAPACITY_INCREASE));
+            if (!new_blockdevs)
+            {
+                return -ENOMEM;
+            }
+
+            blockdevs = new_blockdevs;
             blockdevs_capacity += BLOCKDEVS_CAPACITY_INCREASE;
         }
 
@@ -65,13 +65,15 @@ static int add_pci_device(uint8_t bus, uint8_t device, uint8_t function)
 {
     if (pci_device_count >= pci_device_capacity)
     {
-        size_t pci_device_capacity_old = pci_device_capacity;
-        pci_device_capacity = pci_device_capacity ? pci_device_capacity * 2 : 64;
-        pci_devices = krealloc(pci_devices, pci_device_capacity_old, pci_device_capacity * sizeof(pci_device_t));
-        if (!pci_devices)
+        size_t new_capacity = pci_device_capacity ? pci_device_capacity * 2 : 64;
+        pci_device_t *new_devices = krealloc(pci_devices, new_capacity * sizeof(pci_device_t));
+        if (!new_devices)
         {
             return -ENOMEM;
         }
+
+        pci_devices = new_devices;
+        pci_device_capacity = new_capacity;
     }
 
     pci_device_t *dev = &pci_devices[pci_device_count++];
@@ -116,6 +116,16 @@ static void keyboard_irq(interrupt_frame_t *frame)
             set_keyboard_leds(false, false, caps_lock_down);
             key_buffer_size--;
             return;
+#ifdef KMM_PROFILE
+        case 0x58: // f12
+            if (ctrl_down && alt_down)
+            {
+                kmm_profile_report(KMM_PROFILE_REPORT_MIN_AGE_MS); // only reads the tables, safe from the irq
+                key_buffer_size--;
+                return;
+            }
+            break;
+#endif
         default:
             break;
         }
@@ -1,5 +1,8 @@
 #include <kernel/fs/vfs.h>
 #include <kernel/kmm.h>
+#include <kernel/slab.h>
+#include <kernel/vmalloc.h>
+#include <kernel/arena.h>
 #include <kernel/string.h>
 
 /*
@@ -10,6 +13,9 @@
  - files and directories can't be created with long filenames
 */
 
+static kmem_cache_t *direntry_cache = NULL;
+static kmem_cache_t *file_node_cache = NULL;
+
 static void read_fat_device(virtual_blockdev_t *device, size_t lba, size_t size, uint8_t *buf)
 {
     size_t current_lba = lba + device->lba_offset;
@@ -464,12 +470,13 @@ static uint32_t read_fat_entry(uint32_t cluster_num, boot_sector_t *boot_sector,
 
     size_t lba = boot_sector->bpb.reserved_sector_count + sector_offset;
 
-    uint32_t *fat_section = kmalloc(boot_sector->bpb.bytes_per_sector);
+    arena_t scratch = arena_begin();
+    uint32_t *fat_section = arena_alloc(boot_sector->bpb.bytes_per_sector);
     read_fat_device(dev, lba, 1, (uint8_t *)fat_section);
 
     uint32_t fat_entry = *(uint32_t *)((uint8_t *)fat_section + lba_offset);
 
-    kfree(fat_section);
+    arena_end(scratch);
     return fat_entry;
 }
 
@@ -481,20 +488,22 @@ static void write_fat_entry(uint32_t cluster_num, uint32_t value, boot_sector_t
 
     size_t lba = boot_sector->bpb.reserved_sector_count + sector_offset;
 
-    uint32_t *fat_section = kmalloc(boot_sector->bpb.bytes_per_sector);
+    arena_t scratch = arena_begin();
+    uint32_t *fat_section = arena_alloc(boot_sector->bpb.bytes_per_sector);
     read_fat_device(dev, lba, 1, (uint8_t *)fat_section);
 
     uint32_t *fat_entry = (uint32_t *)((uint8_t *)fat_section + lba_offset);
     *fat_entry = value;
     write_fat_device(dev, lba, 1, (uint8_t *)fat_section);
 
-    kfree(fat_section);
+    arena_end(scratch);
 }
 
 static directory_entry_t *find_entry_by_name(const char *name, uint32_t directory_cluster_num, boot_sector_t *boot_sector, virtual_blockdev_t *dev)
 {
     uint32_t current_cluster = directory_cluster_num;
-    uint8_t *cluster_buf = kmalloc(boot_sector->bpb.sectors_per_cluster * boot_sector->bpb.bytes_per_sector);
+    arena_t scratch = arena_begin();
+    uint8_t *cluster_buf = arena_alloc(boot_sector->bpb.sectors_per_cluster * boot_sector->bpb.bytes_per_sector);
 
     while (current_cluster < 0x0FFFFFF8)
     {
@@ -504,7 +513,7 @@ static directory_entry_t *find_entry_by_name(const char *name, uint32_t director
         {
             if (direntries[i].name[0] == 0x00)
             {
-                kfree(cluster_buf);
+                arena_end(scratch);
                 return NULL;
             }
 
@@ -550,9 +559,12 @@ static directory_entry_t *find_entry_by_name(const char *name, uint32_t director
 
             if (strncmp(filename, name, 11) == 0)
             {
-                directory_entry_t *res = kmalloc(sizeof(directory_entry_t));
-                memcpy(res, &direntries[i], sizeof(directory_entry_t));
-                kfree(cluster_buf);
+                directory_entry_t *res = kmem_cache_alloc(direntry_cache);
+                if (res)
+                {
+                    memcpy(res, &direntries[i], sizeof(directory_entry_t));
+                }
+                arena_end(scratch);
                 return res;
             }
         }
@@ -560,14 +572,15 @@ static directory_entry_t *find_entry_by_name(const char *name, uint32_t director
         current_cluster = read_fat_entry(current_cluster, boot_sector, dev);
     }
 
-    kfree(cluster_buf);
+    arena_end(scratch);
     return NULL;
 }
 
 static int modify_direntry_in_directory(const char *name, uint32_t directory_cluster_num, directory_entry_t *new_direntry, boot_sector_t *boot_sector, virtual_blockdev_t *dev)
 {
     uint32_t current_cluster = directory_cluster_num;
-    uint8_t *cluster_buf = kmalloc(boot_sector->bpb.sectors_per_cluster * boot_sector->bpb.bytes_per_sector);
+    arena_t scratch = arena_begin();
+    uint8_t *cluster_buf = arena_alloc(boot_sector->bpb.sectors_per_cluster * boot_sector->bpb.bytes_per_sector);
 
     while (current_cluster < 0x0FFFFFF8)
     {
@@ -577,7 +590,7 @@ static int modify_direntry_in_directory(const char *name, uint32_t directory_clu
         {
             if (direntries[i].name[0] == 0x00)
             {
-                kfree(cluster_buf);
+                arena_end(scratch);
                 return -ERECOV;
             }
 
@@ -625,6 +638,7 @@ static int modify_direntry_in_directory(const char *name, uint32_t directory_clu
             {
                 memcpy(&direntries[i], new_direntry, sizeof(directory_entry_t));
                 write_cluster(current_cluster, cluster_buf, boot_sector, dev);
+                arena_end(scratch);
                 return 0;
             }
         }
@@ -632,14 +646,15 @@ static int modify_direntry_in_directory(const char *name, uint32_t directory_clu
         current_cluster = read_fat_entry(current_cluster, boot_sector, dev);
     }
 
-    kfree(cluster_buf);
+    arena_end(scratch);
     return -ERECOV;
 }
 
 static directory_entry_t *find_entry_by_index(size_t index, uint32_t directory_cluster_num, char *filename /*256 bytes*/, boot_sector_t *boot_sector, virtual_blockdev_t *dev)
 {
     uint32_t current_cluster = directory_cluster_num;
-    uint8_t *cluster_buf = kmalloc(boot_sector->bpb.sectors_per_cluster * boot_sector->bpb.bytes_per_sector);
+    arena_t scratch = arena_begin();
+    uint8_t *cluster_buf = arena_alloc(boot_sector->bpb.sectors_per_cluster * boot_sector->bpb.bytes_per_sector);
 
     size_t j = 0;
     while (current_cluster < 0x0FFFFFF8)
@@ -650,7 +665,7 @@ static directory_entry_t *find_entry_by_index(size_t index, uint32_t directory_c
         {
             if (direntries[i].name[0] == 0x00)
             {
-                kfree(cluster_buf);
+                arena_end(scratch);
                 return NULL;
             }
 
@@ -697,9 +712,12 @@ static directory_entry_t *find_entry_by_index(size_t index, uint32_t directory_c
                     fat32_nameext_to_name(direntries[i].nameext, filename);
                 }
 
-                directory_entry_t *res = kmalloc(sizeof(directory_entry_t));
-                memcpy(res, &direntries[i], sizeof(directory_entry_t));
-                kfree(cluster_buf);
+                directory_entry_t *res = kmem_cache_alloc(direntry_cache);
+                if (res)
+                {
+                    memcpy(res, &direntries[i], sizeof(directory_entry_t));
+                }
+                arena_end(scratch);
                 return res;
             }
         }
@@ -708,7 +726,7 @@ static directory_entry_t *find_entry_by_index(size_t index, uint32_t directory_c
         j += 16;
     }
 
-    kfree(cluster_buf);
+    arena_end(scratch);
     return NULL;
 }
 
@@ -716,7 +734,13 @@ static directory_entry_t *direntry_from_path(const char *path, boot_sector_t *bo
 {
     directory_entry_t *direntry = (directory_entry_t *)1;
 
-    char *path_cpy = strdup(path);
+    arena_t scratch = arena_begin();
+    char *path_cpy = arena_strdup(path);
+    if (!path_cpy)
+    {
+        arena_end(scratch);
+        return NULL;
+    }
     char *pch = strtok(path_cpy, "/");
 
     size_t current_cluster = boot_sector->bpb.root_cluster;
@@ -725,22 +749,23 @@ static directory_entry_t *direntry_from_path(const char *path, boot_sector_t *bo
         direntry = find_entry_by_name(pch, current_cluster, boot_sector, dev);
         if (!direntry)
         {
-            kfree(path_cpy);
+            arena_end(scratch);
             return NULL;
         }
         current_cluster = (((uint32_t)direntry->first_cluster_hi) << 16) | ((uint32_t)direntry->first_cluster_low);
         pch = strtok(NULL, "/");
         if (pch != NULL)
         {
-            kfree(direntry);
+            kmem_cache_free(direntry_cache, direntry);
         }
     }
-    kfree(path_cpy);
+    arena_end(scratch);
 
     return direntry;
 }
 
-char *get_parent_directory(const char *path)
+// allocated in the current arena scope
+static char *get_parent_directory(const char *path)
 {
     if (path == NULL)
     {
@@ -750,7 +775,7 @@ char *get_parent_directory(const char *path)
     size_t len = strlen(path);
     if (len == 0)
     {
-        return strdup("");
+        return arena_strdup("");
     }
 
     while (len > 0 && path[len - 1] == '/')
@@ -761,12 +786,12 @@ char *get_parent_directory(const char *path)
     const char *last_slash = memrchr(path, '/', len);
     if (last_slash == NULL)
     {
-        return strdup("");
+        return arena_strdup("");
     }
 
     size_t parent_len = last_slash - path + 1;
 
-    char *parent_dir = (char *)kmalloc(parent_len + 1);
+    char *parent_dir = arena_alloc(parent_len + 1);
     if (parent_dir == NULL)
     {
         return NULL;
@@ -778,7 +803,8 @@ char *get_parent_directory(const char *path)
     return parent_dir;
 }
 
-char *get_filename(const char *path)
+// allocated in the current arena scope
+static char *get_filename(const char *path)
 {
     if (path == NULL)
     {
@@ -788,15 +814,15 @@ char *get_filename(const char *path)
     const char *last_slash = strrchr(path, '/');
     if (last_slash == NULL)
     {
-        return strdup(path);
+        return arena_strdup(path);
     }
     else if (*(last_slash + 1) == '\0')
     {
-        return strdup("");
+        return arena_strdup("");
     }
     else
     {
-        return strdup(last_slash + 1);
+        return arena_strdup(last_slash + 1);
     }
 }
 
@@ -829,9 +855,11 @@ static int modify_direntry(const char *path, directory_entry_t *new_direntry, bo
 {
     directory_entry_t *direntry = (directory_entry_t *)1;
 
+    arena_t scratch = arena_begin();
     char *new_path = get_parent_directory(path);
     if (new_path == NULL)
     {
+        arena_end(scratch);
         return -ERECOV;
     }
     char *pch = strtok(new_path, "/");
@@ -842,34 +870,34 @@ static int modify_direntry(const char *path, directory_entry_t *new_direntry, bo
         direntry = find_entry_by_name(pch, current_cluster, boot_sector, dev);
         if (!direntry)
         {
-            kfree(new_path);
+            arena_end(scratch);
             return -ERECOV;
         }
         current_cluster = (((uint32_t)direntry->first_cluster_hi) << 16) | ((uint32_t)direntry->first_cluster_low);
         pch = strtok(NULL, "/");
         if (pch != NULL)
         {
-            kfree(direntry);
+            kmem_cache_free(direntry_cache, direntry);
         }
     }
-    kfree(new_path);
 
     char *path_end = get_filename(path);
     if (path_end == NULL)
     {
+        arena_end(scratch);
         return -ERECOV;
     }
     
     int status = modify_direntry_in_directory(path_end, first_cluster_from_direntry(direntry, boot_sector), new_direntry, boot_sector, dev);
+    arena_end(scratch);
     if (status < 0)
     {
         return status;
     }
 
-    kfree(path_end);
     if ((uintptr_t)direntry != 1)
     {
-        kfree(direntry);
+        kmem_cache_free(direntry_cache, direntry);
     }
 
     return 0;
@@ -891,7 +919,12 @@ static uint32_t find_last_cluster(uint32_t start_cluster, boot_sector_t *boot_se
 static uint32_t allocate_new_cluster(uint32_t last_cluster, boot_sector_t *boot_sector, virtual_blockdev_t *dev)
 {
     uint32_t fat_size = boot_sector->bpb.FAT_size_32;
-    uint8_t *fat_table = kmalloc(fat_size * boot_sector->bpb.bytes_per_sector);
+    uint8_t *fat_table = vmalloc(fat_size * boot_sector->bpb.bytes_per_sector);
+    if (!fat_table)
+    {
+        return 0x0FFFFFF8;
+    }
+
     read_fat_device(dev, boot_sector->bpb.reserved_sector_count, fat_size, fat_table);
 
     uint32_t new_cluster = 2;
@@ -906,7 +939,7 @@ static uint32_t allocate_new_cluster(uint32_t last_cluster, boot_sector_t *boot_
 
     if (new_cluster >= (fat_size * boot_sector->bpb.bytes_per_sector / 4))
     {
-        kfree(fat_table);
+        vfree(fat_table);
         return 0x0FFFFFF8;
     }
 
@@ -916,7 +949,7 @@ static uint32_t allocate_new_cluster(uint32_t last_cluster, boot_sector_t *boot_
     }
 
     write_fat_device(dev, boot_sector->bpb.reserved_sector_count, fat_size, fat_table);
-    kfree(fat_table);
+    vfree(fat_table);
 
     return new_cluster;
 }
@@ -930,10 +963,12 @@ int new_direntry_in_cluster(const char *dir_path, directory_entry_t *new_direntr
     }
 
     uint32_t bytes_per_cluster = boot_sector->bpb.sectors_per_cluster * boot_sector->bpb.bytes_per_sector;
-    uint8_t *cluster_buf = kmalloc(bytes_per_cluster);
+    arena_t scratch = arena_begin();
+    uint8_t *cluster_buf = arena_alloc(bytes_per_cluster);
 
     if (!cluster_buf)
     {
+        arena_end(scratch);
         return -ENOMEM;
     }
 
@@ -953,7 +988,7 @@ int new_direntry_in_cluster(const char *dir_path, directory_entry_t *new_direntr
 
                 write_cluster(current_cluster, cluster_buf, boot_sector, dev);
 
-                kfree(cluster_buf);
+                arena_end(scratch);
                 return 0;
             }
         }
@@ -964,7 +999,7 @@ int new_direntry_in_cluster(const char *dir_path, directory_entry_t *new_direntr
     uint32_t new_cluster = allocate_new_cluster(old_cluster, boot_sector, dev);
     if (new_cluster == (uint32_t)-1)
     {
-        kfree(cluster_buf);
+        arena_end(scratch);
         return -ERECOV;
     }
 
@@ -973,7 +1008,7 @@ int new_direntry_in_cluster(const char *dir_path, directory_entry_t *new_direntr
 
     write_cluster(new_cluster, cluster_buf, boot_sector, dev);
 
-    kfree(cluster_buf);
+    arena_end(scratch);
     return 0;
 }
 
@@ -986,17 +1021,17 @@ int read_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_t
     }
     if ((direntry->attr & ATTR_DIRECTORY) == ATTR_DIRECTORY)
     {
-        kfree(direntry);
+        kmem_cache_free(direntry_cache, direntry);
         return -ERECOV;
     }
 
     direntry->last_access_date = get_fat32_date();
     if (modify_direntry(path, direntry, boot_sector, dev) < 0)
     {
-        kfree(direntry);
+        kmem_cache_free(direntry_cache, direntry);
         return -ERECOV;
     }
-    kfree(direntry);
+    kmem_cache_free(direntry_cache, direntry);
 
     uint32_t current_cluster = first_cluster_from_path(path, boot_sector, dev);
     if (current_cluster == (uint32_t)-1)
@@ -1005,7 +1040,13 @@ int read_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_t
     }
 
     uint32_t bytes_per_cluster = boot_sector->bpb.sectors_per_cluster * boot_sector->bpb.bytes_per_sector;
-    uint8_t *cluster_buf = kmalloc(bytes_per_cluster);
+    arena_t scratch = arena_begin();
+    uint8_t *cluster_buf = arena_alloc(bytes_per_cluster);
+    if (!cluster_buf)
+    {
+        arena_end(scratch);
+        return -ENOMEM;
+    }
 
     uint32_t current_cluster_num = 0;
     size_t buffer_index = 0;
@@ -1024,7 +1065,7 @@ int read_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_t
 
             if (buffer_index == size)
             {
-                kfree(cluster_buf);
+                arena_end(scratch);
                 return 0;
             }
         }
@@ -1038,7 +1079,7 @@ int read_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_t
         {
             read_cluster(current_cluster, cluster_buf, boot_sector, dev);
             memcpy((void *)((uintptr_t)buffer + buffer_index), cluster_buf, size - buffer_index);
-            kfree(cluster_buf);
+            arena_end(scratch);
             return 0;
         }
 
@@ -1046,7 +1087,7 @@ int read_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_t
         current_cluster_num++;
     }
 
-    kfree(cluster_buf);
+    arena_end(scratch);
     return 0;
 }
 
@@ -1059,7 +1100,7 @@ int write_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_t
     }
     if ((direntry->attr & ATTR_DIRECTORY) == ATTR_DIRECTORY)
     {
-        kfree(direntry);
+        kmem_cache_free(direntry_cache, direntry);
         return -ERECOV;
     }
 
@@ -1068,10 +1109,12 @@ int write_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_t
 
     uint32_t cluster_size = boot_sector->bpb.sectors_per_cluster * boot_sector->bpb.bytes_per_sector;
     uint32_t last_cluster = find_last_cluster(first_cluster, boot_sector, dev);
-    uint8_t *cluster_buf = kmalloc(cluster_size);
+    arena_t scratch = arena_begin();
+    uint8_t *cluster_buf = arena_alloc(cluster_size);
     if (!cluster_buf)
     {
-        kfree(direntry);
+        kmem_cache_free(direntry_cache, direntry);
+        arena_end(scratch);
         return -ERECOV;
     }
 
@@ -1098,8 +1141,8 @@ int write_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_t
         last_cluster = allocate_new_cluster(last_cluster, boot_sector, dev);
         if (last_cluster == (uint32_t)-1)
         {
-            kfree(direntry);
-            kfree(cluster_buf);
+            kmem_cache_free(direntry_cache, direntry);
+            arena_end(scratch);
             return -ERECOV;
         }
 
@@ -1113,7 +1156,7 @@ int write_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_t
         size_left -= to_copy;
     }
 
-    kfree(cluster_buf);
+    arena_end(scratch);
 
     direntry->file_size += size;
     direntry->write_date = get_fat32_date();
@@ -1122,11 +1165,11 @@ int write_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_t
 
     if (modify_direntry(path, direntry, boot_sector, dev) < 0)
     {
-        kfree(direntry);
+        kmem_cache_free(direntry_cache, direntry);
         return -ERECOV;
     }
 
-    kfree(direntry);
+    kmem_cache_free(direntry_cache, direntry);
     return 0;
 }
 
@@ -1163,7 +1206,7 @@ file_info_t *stat_fat32(file_info_t *file_info, const char *path, boot_sector_t
         direntry->last_access_date = get_fat32_date();
         if (modify_direntry(path, direntry, boot_sector, dev) < 0)
         {
-            kfree(direntry);
+            kmem_cache_free(direntry_cache, direntry);
             return NULL;
         }
     }
@@ -1212,7 +1255,7 @@ file_info_t *stat_fat32(file_info_t *file_info, const char *path, boot_sector_t
         file_info->filesize = direntry->file_size;
     }
 
-    kfree(direntry);
+    kmem_cache_free(direntry_cache, direntry);
 
     return file_info;
 }
@@ -1240,7 +1283,7 @@ size_t readdir_fat32(char *res, const char *path, size_t index, boot_sector_t *b
         direntry->last_access_date = get_fat32_date();
         if (modify_direntry(path, direntry, boot_sector, dev) < 0)
         {
-            kfree(direntry);
+            kmem_cache_free(direntry_cache, direntry);
             return 0;
         }
     }
@@ -1252,7 +1295,7 @@ size_t readdir_fat32(char *res, const char *path, size_t index, boot_sector_t *b
         return 0;
     }
 
-    kfree(direntry);
+    kmem_cache_free(direntry_cache, direntry);
 
     strcpy(res, filename);
     return strlen(filename);
@@ -1267,7 +1310,7 @@ int clear_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_t
     }
     if ((direntry->attr & ATTR_DIRECTORY) == ATTR_DIRECTORY)
     {
-        kfree(direntry);
+        kmem_cache_free(direntry_cache, direntry);
         return -ERECOV;
     }
 
@@ -1289,11 +1332,11 @@ int clear_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_t
 
     if (modify_direntry(path, direntry, boot_sector, dev) < 0)
     {
-        kfree(direntry);
+        kmem_cache_free(direntry_cache, direntry);
         return -ERECOV;
     }
 
-    kfree(direntry);
+    kmem_cache_free(direntry_cache, direntry);
     return 0;
 }
 
@@ -1321,18 +1364,18 @@ int write_mask_fat32(const char *path, uint32_t mask, boot_sector_t *boot_sector
 
     if (direntry->attr == attr)
     {
-        kfree(direntry);
+        kmem_cache_free(direntry_cache, direntry);
         return 0;
     }
 
     direntry->attr = attr;
     if (modify_direntry(path, direntry, boot_sector, dev) < 0)
     {
-        kfree(direntry);
+        kmem_cache_free(direntry_cache, direntry);
         return -ERECOV;
     }
 
-    kfree(direntry);
+    kmem_cache_free(direntry_cache, direntry);
     return 0;
 }
 
@@ -1346,18 +1389,14 @@ int create_fat32(const char *path, uint32_t mask, uint32_t flags, boot_sector_t
 
     directory_entry_t new_direntry;
 
+    arena_t scratch = arena_begin();
     char *filename = get_filename(path);
-    if (!filename)
+    if (!filename || name_to_fat32_nameext(filename, new_direntry.nameext) < 0)
     {
+        arena_end(scratch);
         return -ERECOV;
     }
-
-    if (name_to_fat32_nameext(filename, new_direntry.nameext) < 0)
-    {
-        return -ERECOV;
-    }
-
-    kfree(filename);
+    arena_end(scratch);
 
     uint8_t attr = 0;
     if ((mask & MASK_READONLY) == MASK_READONLY)
@@ -1395,19 +1434,15 @@ int create_fat32(const char *path, uint32_t mask, uint32_t flags, boot_sector_t
     new_direntry.write_date = get_fat32_date();
     new_direntry.file_size = 0;
 
+    scratch = arena_begin();
     char *dirpath = get_parent_directory(path);
-    if (!dirpath)
+    if (!dirpath || new_direntry_in_cluster(dirpath, &new_direntry, boot_sector, dev) < 0)
     {
+        arena_end(scratch);
         return -ERECOV;
     }
 
-    if (new_direntry_in_cluster(dirpath, &new_direntry, boot_sector, dev) < 0)
-    {
-        kfree(dirpath);
-        return -ERECOV;
-    }
-
-    kfree(dirpath);
+    arena_end(scratch);
     return 0;
 }
 
@@ -1420,7 +1455,7 @@ int delete_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_
     }
     if ((direntry->attr & ATTR_DIRECTORY) == ATTR_DIRECTORY)
     {
-        kfree(direntry);
+        kmem_cache_free(direntry_cache, direntry);
         return -ERECOV;
     }
 
@@ -1434,25 +1469,21 @@ int delete_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_
         current_cluster = next_cluster;
     }
     write_fat_entry(first_cluster, 0, boot_sector, dev);
-    kfree(direntry);
+    kmem_cache_free(direntry_cache, direntry);
 
+    arena_t scratch = arena_begin();
     char *dirpath = get_parent_directory(path);
-    if (!dirpath)
+    char *filename = get_filename(path);
+    if (!dirpath || !filename)
     {
+        arena_end(scratch);
         return -ERECOV;
     }
 
     uint32_t directory_cluster = first_cluster_from_path(dirpath, boot_sector, dev);
     if (directory_cluster == 0)
     {
-        kfree(dirpath);
-        return -ERECOV;
-    }
-    kfree(dirpath);
-
-    char *filename = get_filename(path);
-    if (!filename)
-    {
+        arena_end(scratch);
         return -ERECOV;
     }
 
@@ -1461,11 +1492,11 @@ int delete_fat32(const char *path, boot_sector_t *boot_sector, virtual_blockdev_
 
     if (modify_direntry_in_directory(filename, directory_cluster, &new_direntry, boot_sector, dev) < 0)
     {
-        kfree(filename);
+        arena_end(scratch);
         return -ERECOV;
     }
 
-    kfree(filename);
+    arena_end(scratch);
     
     return 0;
 }
@@ -1477,7 +1508,7 @@ file_node_t *fat32_open(const char *path, uint8_t action, virtual_blockdev_t *bd
         return NULL;
     }
 
-    file_node_t *node = kmalloc(sizeof(file_node_t));
+    file_node_t *node = kmem_cache_alloc(file_node_cache);
     if (!node)
     {
         return NULL;
@@ -1487,6 +1518,7 @@ file_node_t *fat32_open(const char *path, uint8_t action, virtual_blockdev_t *bd
     {
         if (create_fat32(path, 0, FS_FILE, (boot_sector_t *)data, bdev) < 0)
         {
+            kmem_cache_free(file_node_cache, node);
             return NULL;
         }
     }
@@ -1494,6 +1526,7 @@ file_node_t *fat32_open(const char *path, uint8_t action, virtual_blockdev_t *bd
     {
         if (clear_fat32(path, (boot_sector_t *)data, bdev) < 0)
         {
+            kmem_cache_free(file_node_cache, node);
             return NULL;
         }
     }
@@ -1501,6 +1534,7 @@ file_node_t *fat32_open(const char *path, uint8_t action, virtual_blockdev_t *bd
     file_info_t info;
     if (!stat_fat32(&info, path, (boot_sector_t *)data, bdev))
     {
+        kmem_cache_free(file_node_cache, node);
         return NULL;
     }
 
@@ -1527,7 +1561,7 @@ int fat32_close(file_node_t *node, virtual_blockdev_t *bdev, void *data)
     (void)bdev;
     (void)data;
 
-    kfree(node);
+    kmem_cache_free(file_node_cache, node);
 
     return 0;
 }
@@ -1586,6 +1620,22 @@ void *fat32_init(virtual_blockdev_t *bdev)
         return NULL;
     }
 
+    // shared by all mounted fat32 filesystems
+    if (!direntry_cache)
+    {
+        direntry_cache = kmem_cache_create("fat32_direntry", sizeof(directory_entry_t), 0, NULL);
+    }
+
+    if (!file_node_cache)
+    {
+        file_node_cache = kmem_cache_create("file_node_t", sizeof(file_node_t), 0, NULL);
+    }
+
+    if (!direntry_cache || !file_node_cache)
+    {
+        return NULL;
+    }
+
     return (void *)scan_fat(bdev->bdev->block_size, bdev);
 }
 
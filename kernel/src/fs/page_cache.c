@@ -0,0 +1,294 @@
+#include <kernel/fs/page_cache.h>
+#include <kernel/pmm.h>
+#include <kernel/kmm.h>
+#include <kernel/arena.h>
+#include <kernel/kprintf.h>
+#include <kernel/string.h>
+
+static page_cache_t *caches = NULL;
+static bool shrinker_registered = false;
+
+static file_node_t *open_file(page_cache_t *cache, uint8_t action)
+{
+    return vfs_open(cache->path, action);
+}
+
+static void drop_pages(page_cache_t *cache, bool all)
+{
+    for (size_t i = 0; i < cache->num_pages; i++)
+    {
+        // pages that are still mapped somewhere are left to their mappings
+        if (cache->pages[i] && (all || pmm_get_refs(cache->pages[i]) == 1))
+        {
+            pmm_free(cache->pages[i]);
+            cache->pages[i] = NULL;
+            cache->num_cached--;
+        }
+    }
+}
+
+static void unlink_cache(page_cache_t *cache)
+{
+    for (page_cache_t **link = &caches; *link; link = &(*link)->next)
+    {
+        if (*link == cache)
+        {
+            *link = cache->next;
+            return;
+        }
+    }
+}
+
+static void free_cache(page_cache_t *cache)
+{
+    unlink_cache(cache);
+    drop_pages(cache, true);
+    kfree(cache->pages);
+    kfree(cache);
+}
+
+static size_t page_cache_shrink(void)
+{
+    size_t res = 0;
+    page_cache_t *cache = caches;
+    while (cache)
+    {
+        page_cache_t *next = cache->next;
+        if (!cache->dirty && !cache->filling)
+        {
+            size_t cached = cache->num_cached;
+            drop_pages(cache, false);
+            res += cached - cache->num_cached;
+
+            if (cache->refs == 0)
+            {
+                free_cache(cache);
+            }
+        }
+        cache = next;
+    }
+
+    return res;
+}
+
+page_cache_t *page_cache_get(file_node_t *node, bool shared)
+{
+    if (!node)
+    {
+        return NULL;
+    }
+
+    if (!shrinker_registered && pmm_register_shrinker(page_cache_shrink) == 0)
+    {
+        shrinker_registered = true;
+    }
+
+    char path[MAX_PATH + 13];
+    vfs_get_path(node, path, sizeof(path));
+
+    for (page_cache_t *cache = caches; cache; cache = cache->next)
+    {
+        if (cache->stale || strncmp(cache->path, path, sizeof(path)) != 0)
+        {
+            continue;
+        }
+
+        if (cache->write_time == node->write_time && cache->write_date == node->write_date && cache->filesize == node->filesize)
+        {
+            return page_cache_ref(cache, shared);
+        }
+
+        // the file changed, existing mappings keep the old pages
+        if (cache->refs == 0 && !cache->dirty)
+        {
+            free_cache(cache);
+        }
+        else
+        {
+            cache->stale = true;
+        }
+        break;
+    }
+
+    page_cache_t *cache = kmalloc(sizeof(page_cache_t));
+    if (!cache)
+    {
+        return NULL;
+    }
+
+    memset(cache, 0, sizeof(page_cache_t));
+    strncpy(cache->path, path, sizeof(path));
+    cache->write_time = node->write_time;
+    cache->write_date = node->write_date;
+    cache->filesize = node->filesize;
+    cache->num_pages = (node->filesize + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    if (cache->num_pages > 0)
+    {
+        cache->pages = kmalloc(cache->num_pages * sizeof(void *));
+        if (!cache->pages)
+        {
+            kfree(cache);
+            return NULL;
+        }
+        memset(cache->pages, 0, cache->num_pages * sizeof(void *));
+    }
+
+    cache->next = caches;
+    caches = cache;
+
+    return page_cache_ref(cache, shared);
+}
+
+page_cache_t *page_cache_ref(page_cache_t *cache, bool shared)
+{
+    cache->refs++;
+    if (shared)
+    {
+        cache->shared_refs++;
+    }
+
+    return cache;
+}
+
+void page_cache_put(page_cache_t *cache, bool shared)
+{
+    if (!cache)
+    {
+        return;
+    }
+
+    if (shared && --cache->shared_refs == 0 && cache->dirty)
+    {
+        if (page_cache_writeback(cache) < 0)
+        {
+            kprintf("page cache: failed to write back %s\n", cache->path);
+        }
+    }
+
+    if (--cache->refs == 0 && cache->stale)
+    {
+        free_cache(cache);
+    }
+}
+
+// fills the missing pages of [index, index + num) with one read
+static int read_pages(page_cache_t *cache, size_t index, size_t num)
+{
+    file_node_t *node = open_file(cache, OPEN_ACTION_READ);
+    if (!node)
+    {
+        return -ERECOV;
+    }
+
+    arena_t scratch = arena_begin();
+    size_t offset = index * PAGE_SIZE;
+    size_t size = cache->filesize - offset < num * PAGE_SIZE ? cache->filesize - offset : num * PAGE_SIZE;
+    uint8_t *buf = arena_alloc(size);
+
+    int status = buf ? vfs_seek(node, offset, SEEK_TYPE_SET) : -ENOMEM;
+    if (status == 0)
+    {
+        status = vfs_read(node, size, buf);
+    }
+
+    for (size_t i = 0; status == 0 && i < num; i++)
+    {
+        if (cache->pages[index + i])
+        {
+            continue;
+        }
+
+        uint8_t *page = pmm_alloc();
+        if (!page)
+        {
+            status = -ENOMEM;
+            break;
+        }
+
+        // the tail of the last page is zero filled
+        size_t page_size = size - i * PAGE_SIZE < PAGE_SIZE ? size - i * PAGE_SIZE : PAGE_SIZE;
+        memcpy(page, buf + i * PAGE_SIZE, page_size);
+        memset(page + page_size, 0, PAGE_SIZE - page_size);
+
+        cache->pages[index + i] = page;
+        cache->num_cached++;
+    }
+
+    arena_end(scratch);
+    vfs_close(node);
+
+    return status;
+}
+
+void *page_cache_get_page(page_cache_t *cache, size_t index)
+{
+    if (!cache || index >= cache->num_pages)
+    {
+        return NULL;
+    }
+
+    if (!cache->pages[index])
+    {
+        // the shrinker must not take pages away while they are read in
+        size_t num = cache->num_pages - index < PAGE_CACHE_READAHEAD ? cache->num_pages - index : PAGE_CACHE_READAHEAD;
+        cache->filling = true;
+        int status = read_pages(cache, index, num);
+        cache->filling = false;
+
+        if (status < 0 && !cache->pages[index])
+        {
+            return NULL;
+        }
+    }
+
+    return cache->pages[index];
+}
+
+int page_cache_writeback(page_cache_t *cache)
+{
+    if (!cache)
+    {
+        return -EINVARG;
+    }
+
+    // the file gets rewritten from the start, so every page has to be in memory before it is cleared
+    for (size_t i = 0; i < cache->num_pages; i++)
+    {
+        if (!page_cache_get_page(cache, i))
+        {
+            return -ENOMEM;
+        }
+    }
+
+    file_node_t *node = open_file(cache, OPEN_ACTION_CLEAR);
+    if (!node)
+    {
+        return -ERECOV;
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < cache->num_pages && status == 0; i++)
+    {
+        size_t size = cache->filesize - i * PAGE_SIZE < PAGE_SIZE ? cache->filesize - i * PAGE_SIZE : PAGE_SIZE;
+        status = vfs_write(node, size, cache->pages[i]);
+    }
+    vfs_close(node);
+
+    if (status < 0)
+    {
+        return status;
+    }
+
+    // the write changed the modification time, the cache still matches the file
+    node = open_file(cache, OPEN_ACTION_READ);
+    if (node)
+    {
+        cache->write_time = node->write_time;
+        cache->write_date = node->write_date;
+        vfs_close(node);
+    }
+
+    cache->dirty = false;
+    return 0;
+}
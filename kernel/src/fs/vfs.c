@@ -1,6 +1,7 @@
 #include <kernel/fs/vfs.h>
 #include <kernel/kmm.h>
 #include <kernel/string.h>
+#include <kernel/kprintf.h>
 
 #define FILESYSTEMS_CAPACITY_INCREASE 3
 
@@ -29,7 +30,13 @@ int register_filesystem(filesystem_t *fs)
 
     if (filesystems_size >= filesystems_capacity)
     {
-        filesystems = krealloc(filesystems, filesystems_capacity, filesystems_capacity + sizeof(filesystem_t *) * FILESYSTEMS_CAPACITY_INCREASE);
+        filesystem_t **new_filesystems = krealloc(filesystems, sizeof(filesystem_t *) * (filesystems_capacity + FILESYSTEMS_CAPACITY_INCREASE));
+        if (!new_filesystems)
+        {
+            return -ENOMEM;
+        }
+
+        filesystems = new_filesystems;
         filesystems_capacity += FILESYSTEMS_CAPACITY_INCREASE;
     }
 
@@ -252,6 +259,17 @@ file_node_t *vfs_open(const char *path, uint8_t action)
     return NULL;
 }
 
+int vfs_get_path(file_node_t *node, char *path, size_t size)
+{
+    if (!node || !path)
+    {
+        return -EINVARG;
+    }
+
+    snprintf(path, size, "%d:%s", node->mount_id, node->local_path);
+    return 0;
+}
+
 int vfs_close(file_node_t *node)
 {
     if (!node)
@@ -181,7 +181,13 @@ int register_partition_table(partition_table_t *pt)
 
     if (partition_tables_size >= partition_tables_capacity)
     {
-        partition_tables = krealloc(partition_tables, partition_tables_capacity, partition_tables_capacity + sizeof(partition_table_t *) * PARTITION_TABLES_CAPACITY_INCREASE);
+        partition_table_t **new_partition_tables = krealloc(partition_tables, sizeof(partition_table_t *) * (partition_tables_capacity + PARTITION_TABLES_CAPACITY_INCREASE));
+        if (!new_partition_tables)
+        {
+            return -ENOMEM;
+        }
+
+        partition_tables = new_partition_tables;
         partition_tables_capacity += PARTITION_TABLES_CAPACITY_INCREASE;
     }
 
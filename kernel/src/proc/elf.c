@@ -37,60 +37,55 @@ static bool elf_has_program_header(Elf64_Ehdr *header)
 
 Elf64_Ehdr *elf_header(elf_file_t *elf_file)
 {
-    return elf_file->file_content;
+    return &elf_file->header;
 }
 
-Elf64_Shdr *elf_sheader(Elf64_Ehdr *header)
+int elf_validate_loaded(Elf64_Ehdr *header)
 {
-    return (Elf64_Shdr *)((uintptr_t)header + header->e_shoff);
+    return (elf_valid_signature((char *)header) && elf_valid_class(header) && elf_valid_encoding(header) && elf_has_program_header(header) && elf_is_executable(header)) ? EOK : -ERECOV;
 }
 
-Elf64_Phdr *elf_pheader(Elf64_Ehdr *header)
+uint64_t elf_entry(elf_file_t *file)
 {
-    if (!elf_has_program_header(header))
-    {
-        return NULL;
-    }
-
-    return (Elf64_Phdr *)((uintptr_t)header + header->e_phoff);
+    return elf_get_entry(elf_header(file));
 }
 
-Elf64_Shdr *elf_section(Elf64_Ehdr *header, int index)
+// only the headers are read, the segments are streamed into their pages through the page cache
+static int read_headers(elf_file_t *elf_file)
 {
-    return &elf_sheader(header)[index];
-}
+    Elf64_Ehdr *header = elf_header(elf_file);
+    file_node_t *node = elf_file->node;
 
-Elf64_Phdr *elf_program_header(Elf64_Ehdr *header, int index)
-{
-    return &elf_pheader(header)[index];
-}
+    if (node->filesize < sizeof(Elf64_Ehdr) || vfs_read(node, sizeof(Elf64_Ehdr), (uint8_t *)header) < 0)
+    {
+        return -ERECOV;
+    }
 
-char *elf_str_table(Elf64_Ehdr *header)
-{
-    return (char *)header + elf_section(header, header->e_shstrndx)->sh_offset;
-}
+    int status = elf_validate_loaded(header);
+    if (status < 0)
+    {
+        return status;
+    }
 
-int elf_validate_loaded(Elf64_Ehdr *header)
-{
-    return (elf_valid_signature((char *)header) && elf_valid_class(header) && elf_valid_encoding(header) && elf_has_program_header(header) && elf_is_executable(header)) ? EOK : -ERECOV;
-}
+    size_t size = (size_t)header->e_phnum * sizeof(Elf64_Phdr);
+    if (header->e_phentsize != sizeof(Elf64_Phdr) || header->e_phnum == 0 || header->e_phoff > node->filesize || size > node->filesize - header->e_phoff)
+    {
+        return -ECORRUPT;
+    }
 
-int elf_process_load(elf_file_t *elf_file)
-{
-    Elf64_Ehdr *header = elf_header(elf_file);
+    elf_file->phdrs = kmalloc(size);
+    if (!elf_file->phdrs)
+    {
+        return -ENOMEM;
+    }
 
-    int status = elf_validate_loaded(header);
+    status = vfs_seek(node, header->e_phoff, SEEK_TYPE_SET);
     if (status < 0)
     {
         return status;
     }
 
-    return EOK;
-}
-
-uint64_t elf_entry(elf_file_t *file)
-{
-    return elf_get_entry(elf_header(file));
+    return vfs_read(node, size, (uint8_t *)elf_file->phdrs);
 }
 
 elf_file_t *elf_load(const char *path)
@@ -102,6 +97,7 @@ elf_file_t *elf_load(const char *path)
     }
 
     memset(res, 0, sizeof(elf_file_t));
+    res->refs = 1;
 
     res->node = vfs_open(path, OPEN_ACTION_READ);
     if (!res->node)
@@ -110,20 +106,14 @@ elf_file_t *elf_load(const char *path)
         return NULL;
     }
 
-    res->file_content = kmalloc(res->node->filesize);
-    if (!res->file_content)
-    {
-        elf_free(res);
-        return NULL;
-    }
-
-    if (vfs_read(res->node, res->node->filesize, res->file_content) < 0)
+    if (read_headers(res) < 0)
     {
         elf_free(res);
         return NULL;
     }
 
-    if (elf_process_load(res) < 0)
+    res->cache = page_cache_get(res->node, false);
+    if (!res->cache)
     {
         elf_free(res);
         return NULL;
@@ -132,16 +122,22 @@ elf_file_t *elf_load(const char *path)
     return res;
 }
 
+elf_file_t *elf_ref(elf_file_t *file)
+{
+    file->refs++;
+    return file;
+}
+
 void elf_free(elf_file_t *file)
 {
-    if (!file)
+    if (!file || --file->refs > 0)
     {
         return;
     }
 
-    if (file->file_content)
+    if (file->phdrs)
     {
-        kfree(file->file_content);
+        kfree(file->phdrs);
     }
 
     if (file->node)
@@ -149,144 +145,177 @@ void elf_free(elf_file_t *file)
         vfs_close(file->node);
     }
 
+    page_cache_put(file->cache, false);
     kfree(file);
 }
 
-static int load_phdr(elf_file_t *elf_file, Elf64_Phdr *ph, process_t *proc, uint64_t *data_pages_index, process_t *original)
+static int insert_area(process_t *proc, vma_t *vma)
 {
-    if (!ph)
+    int status = vma_insert(proc, vma);
+    if (status < 0)
     {
-        return -EINVARG;
+        vma_free(vma);
+        return status;
     }
 
-    if (ph->p_type != PT_LOAD)
+    return 0;
+}
+
+// read-only pages that only hold file content come straight from the page cache
+static uintptr_t shared_end(Elf64_Phdr *ph, uintptr_t start, uintptr_t end)
+{
+    if ((ph->p_flags & PF_W) == PF_W || ph->p_vaddr % PAGE_SIZE != ph->p_offset % PAGE_SIZE)
     {
-        return 0;
+        return start;
     }
 
-    int status = vfs_seek(elf_file->node, ph->p_offset, SEEK_TYPE_SET);
-    if (status < 0)
+    if (ph->p_memsz == ph->p_filesz)
     {
-        return status;
+        return end;
     }
 
-    for (size_t i = 0; i < (ph->p_memsz + (PAGE_SIZE - 1)) / PAGE_SIZE; i++)
+    // the page where bss starts needs a zeroed tail, so it is private
+    return (ph->p_vaddr + ph->p_filesz) & ~(uintptr_t)(PAGE_SIZE - 1);
+}
+
+static bool is_loaded(Elf64_Phdr *ph)
+{
+    return ph->p_type == PT_LOAD && ph->p_memsz != 0;
+}
+
+static uintptr_t segment_start(Elf64_Phdr *ph)
+{
+    return ph->p_vaddr & ~(uintptr_t)(PAGE_SIZE - 1);
+}
+
+static uintptr_t segment_end(Elf64_Phdr *ph)
+{
+    return (ph->p_vaddr + ph->p_memsz + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+}
+
+static int check_segment(elf_file_t *elf_file, Elf64_Phdr *ph)
+{
+    size_t filesize = elf_file->node->filesize;
+    if (ph->p_filesz > ph->p_memsz || ph->p_offset > filesize || ph->p_filesz > filesize - ph->p_offset)
     {
-        proc->data_pages[*data_pages_index] = pmm_alloc();
-        if (!proc->data_pages[*data_pages_index])
-        {
-            return -ENOMEM;
-        }
+        return -ECORRUPT;
+    }
 
-        if (ph->p_memsz > ph->p_filesz)
-        {
-            if (original)
-            {
-                memcpy(proc->data_pages[*data_pages_index], original->data_pages[*data_pages_index], PAGE_SIZE);
-            }
-            else
-            {
-                memset(proc->data_pages[*data_pages_index], 0, PAGE_SIZE);
-            }
-        }
-        else
-        {
-            size_t remainder = ph->p_memsz - i * PAGE_SIZE;
-            if (remainder > PAGE_SIZE)
-            {
-                remainder = PAGE_SIZE;
-            }
+    // the page tables below PROCESS_VADDR hold the kernel image and are shared by every process
+    if (ph->p_vaddr < PROCESS_VADDR || ph->p_vaddr >= PROCESS_HEAP_VADDR_END || ph->p_memsz >= PROCESS_HEAP_VADDR_END - ph->p_vaddr)
+    {
+        return -ECORRUPT;
+    }
 
-            status = vfs_read(elf_file->node, remainder, proc->data_pages[*data_pages_index]);
-            if (status < 0)
-            {
-                return status;
-            }
-        }
+    return 0;
+}
 
-        int flags = PAGE_PRESENT | PAGE_USER;
-        if ((ph->p_flags & PF_W) == PF_W)
-        {
-            flags |= PAGE_WRITABLE;
-        }
-        if ((ph->p_flags & PF_X) != PF_X)
+// every loadable segment has to be valid and must not share a page with another one before any area is created
+static int check_segments(elf_file_t *elf_file)
+{
+    Elf64_Half num = elf_header(elf_file)->e_phnum;
+    for (Elf64_Half i = 0; i < num; i++)
+    {
+        Elf64_Phdr *ph = &elf_file->phdrs[i];
+        if (!is_loaded(ph))
         {
-            flags |= PAGE_NO_EXECUTE;
+            continue;
         }
 
-        status = pml4_map(proc->pml4, (void *)(ph->p_vaddr + i * PAGE_SIZE), proc->data_pages[*data_pages_index], flags);
+        int status = check_segment(elf_file, ph);
         if (status < 0)
         {
             return status;
         }
 
-        *data_pages_index += 1;
+        for (Elf64_Half j = 0; j < i; j++)
+        {
+            Elf64_Phdr *other = &elf_file->phdrs[j];
+            if (is_loaded(other) && segment_start(ph) < segment_end(other) && segment_start(other) < segment_end(ph))
+            {
+                return -ECORRUPT;
+            }
+        }
     }
 
     return 0;
 }
 
-int elf_load_and_map(process_t *proc, elf_file_t *elf_file)
+static int map_phdr(elf_file_t *elf_file, Elf64_Phdr *ph, process_t *proc)
 {
-    Elf64_Ehdr *header = elf_header(elf_file);
-    Elf64_Phdr *phdrs = elf_pheader(header);
+    if (!ph)
+    {
+        return -EINVARG;
+    }
 
-    proc->num_data_pages = 0;
-    for (int i = 0; i < header->e_phnum; i++)
+    if (!is_loaded(ph))
     {
-        Elf64_Phdr *phdr = &phdrs[i];
-        if (phdr->p_type != PT_LOAD)
-        {
-            continue;
-        }
-        proc->num_data_pages += (phdr->p_memsz + PAGE_SIZE - 1) / PAGE_SIZE;
+        return 0;
     }
 
-    proc->data_pages = kmalloc(proc->num_data_pages * sizeof(void *));
-    if (!proc->data_pages)
+    uint64_t flags = PAGE_PRESENT | PAGE_USER;
+    if ((ph->p_flags & PF_W) == PF_W)
     {
-        return -ENOMEM;
+        flags |= PAGE_WRITABLE;
+    }
+    if ((ph->p_flags & PF_X) != PF_X)
+    {
+        flags |= PAGE_NO_EXECUTE;
     }
 
-    uint64_t data_pages_index = 0;
-    for (Elf64_Half i = 0; i < header->e_phnum; i++)
+    uintptr_t start = segment_start(ph);
+    uintptr_t end = segment_end(ph);
+    uintptr_t split = shared_end(ph, start, end);
+
+    if (split > start)
     {
-        int status = load_phdr(elf_file, &phdrs[i], proc, &data_pages_index, NULL);
-        if (status < 0)
+        vma_t *vma = vma_create(start, split, flags, 0);
+        if (!vma)
+        {
+            return -ENOMEM;
+        }
+
+        vma->cache = page_cache_ref(elf_file->cache, false);
+        vma->file_offset = ph->p_offset & ~(uint64_t)(PAGE_SIZE - 1);
+        vma->file_start = start;
+        vma->file_end = split;
+
+        int status = insert_area(proc, vma);
+        if (status < 0 || split == end)
         {
             return status;
         }
     }
 
-    return 0;
+    vma_t *vma = vma_create(split, end, flags, 0);
+    if (!vma)
+    {
+        return -ENOMEM;
+    }
+
+    // everything past p_filesz is bss and gets zero filled, the rest is copied out of the page cache
+    vma->file = elf_file->node;
+    vma->cache = page_cache_ref(elf_file->cache, false);
+    vma->file_offset = ph->p_offset;
+    vma->file_start = ph->p_vaddr;
+    vma->file_end = ph->p_vaddr + ph->p_filesz;
+
+    return insert_area(proc, vma);
 }
 
-int elf_load_and_map_copy(process_t *proc, elf_file_t *elf_file, process_t *original) // copys the data sections (useful for forking
+int elf_map_segments(process_t *proc, elf_file_t *elf_file)
 {
     Elf64_Ehdr *header = elf_header(elf_file);
-    Elf64_Phdr *phdrs = elf_pheader(header);
-
-    proc->num_data_pages = 0;
-    for (int i = 0; i < header->e_phnum; i++)
-    {
-        Elf64_Phdr *phdr = &phdrs[i];
-        if (phdr->p_type != PT_LOAD)
-        {
-            continue;
-        }
-        proc->num_data_pages += (phdr->p_memsz + PAGE_SIZE - 1) / PAGE_SIZE;
-    }
 
-    proc->data_pages = kmalloc(proc->num_data_pages * sizeof(void *));
-    if (!proc->data_pages)
+    int status = check_segments(elf_file);
+    if (status < 0)
     {
-        return -ENOMEM;
+        return status;
     }
 
-    uint64_t data_pages_index = 0;
     for (Elf64_Half i = 0; i < header->e_phnum; i++)
     {
-        int status = load_phdr(elf_file, &phdrs[i], proc, &data_pages_index, original);
+        status = map_phdr(elf_file, &elf_file->phdrs[i], proc);
         if (status < 0)
         {
             return status;
@@ -203,9 +203,21 @@ int stream_clone(stream_t *src, stream_t *dest)
         dest->size = src->size;
         break;
     case STREAM_TYPE_FILE:
-        // TODO: implement
-        return -EINVARG;
+    {
+        // the copy gets its own node, opened without clearing the file again
+        char path[MAX_PATH + 13];
+        if (vfs_get_path(src->node, path, sizeof(path)) < 0)
+        {
+            return -ERECOV;
+        }
+
+        if (stream_create_file(dest, src->flags, path, OPEN_ACTION_READ) < 0)
+        {
+            return -ERECOV;
+        }
+        dest->node->offset = src->node->offset;
         break;
+    }
     case STREAM_TYPE_DRIVER:
         stream_create_driver(dest, src->flags, src->device);
         break;
@@ -7,8 +7,14 @@
 #include <kernel/string.h>
 #include <kernel/dev/devm.h>
 
-static void *process_get_pointer(process_t *proc, uintptr_t vaddr)
+static void *process_get_pointer(process_t *proc, uintptr_t vaddr, bool write)
 {
+    // the page may not have been touched yet
+    if (vma_fault(proc, vaddr, write) < 0)
+    {
+        return NULL;
+    }
+
     size_t offset = (uint64_t)vaddr % PAGE_SIZE;
     uint64_t t = pml4_get_phys(proc->pml4, (void *)((vaddr / PAGE_SIZE) * PAGE_SIZE), true);
     if (t == 0)
@@ -19,43 +25,106 @@ static void *process_get_pointer(process_t *proc, uintptr_t vaddr)
     return (void *)(t + offset);
 }
 
-#define DRIVER_TYPE_CHARDEV 0
-#define DRIVER_TYPE_INPUTDEV 1
+static bool stream_valid(int64_t stream)
+{
+    return stream >= 0 && stream < PROCESS_MAX_STREAMS;
+}
 
-int64_t syscall_read(process_t *proc, int64_t stream, int64_t data, int64_t size, int64_t, int64_t, int64_t, task_state_t *)
+// user pages aren't physically contiguous, so buffers are moved one page at a time
+static int64_t stream_transfer(process_t *proc, int64_t stream, uintptr_t data, size_t size, bool to_user)
 {
-    uint8_t *buf = (uint8_t *)process_get_pointer(proc, data);
-    if (!buf)
+    if (!stream_valid(stream))
     {
-        return -EUNKNOWN;
+        return -EINVARG;
     }
 
-    size_t bytes_read = 0;
-    int res = stream_read(&proc->streams[stream], buf, size, &bytes_read);
-    if (res < 0)
+    // every page gets its own copy before anything is written, so no byte ends up in a frame still shared after fork
+    if (to_user && size > 0)
     {
-        return res;
+        for (uintptr_t page = data & ~(uintptr_t)(PAGE_SIZE - 1); page < data + size; page += PAGE_SIZE)
+        {
+            if (vma_fault(proc, page, true) < 0)
+            {
+                return -EUNKNOWN;
+            }
+        }
+    }
+
+    size_t done = 0;
+    while (done < size)
+    {
+        uintptr_t vaddr = data + done;
+        size_t chunk = PAGE_SIZE - vaddr % PAGE_SIZE < size - done ? PAGE_SIZE - vaddr % PAGE_SIZE : size - done;
+
+        uint8_t *buf = (uint8_t *)process_get_pointer(proc, vaddr, to_user);
+        if (!buf)
+        {
+            return done > 0 ? (int64_t)done : -EUNKNOWN;
+        }
+
+        size_t bytes = 0;
+        int res = to_user ? stream_read(&proc->streams[stream], buf, chunk, &bytes) : stream_write(&proc->streams[stream], buf, chunk, &bytes);
+        if (res < 0)
+        {
+            return done > 0 ? (int64_t)done : res;
+        }
+
+        done += bytes;
+        if (bytes < chunk)
+        {
+            break;
+        }
     }
 
-    return (int64_t)bytes_read;
+    return (int64_t)done;
 }
 
-int64_t syscall_write(process_t *proc, int64_t stream, int64_t data, int64_t size, int64_t, int64_t, int64_t, task_state_t *)
+// copies a nul terminated string out of the process, it may cross pages
+static int copy_user_string(process_t *proc, uintptr_t vaddr, char *buf, size_t size)
 {
-    uint8_t *buf = (uint8_t *)process_get_pointer(proc, data);
-    if (!buf)
+    size_t i = 0;
+    while (i < size)
     {
-        return -EUNKNOWN;
+        const char *src = process_get_pointer(proc, vaddr + i, false);
+        if (!src)
+        {
+            return -EINVARG;
+        }
+
+        for (size_t end = i + PAGE_SIZE - (vaddr + i) % PAGE_SIZE; i < end && i < size; i++, src++)
+        {
+            buf[i] = *src;
+            if (*src == '\0')
+            {
+                return 0;
+            }
+        }
     }
 
-    size_t bytes_written = 0;
-    int res = stream_write(&proc->streams[stream], buf, size, &bytes_written);
-    if (res < 0)
+    return -EINVARG;
+}
+
+#define DRIVER_TYPE_CHARDEV 0
+#define DRIVER_TYPE_INPUTDEV 1
+
+int64_t syscall_read(process_t *proc, int64_t stream, int64_t data, int64_t size, int64_t, int64_t, int64_t, task_state_t *)
+{
+    if (size < 0)
     {
-        return res;
+        return -EINVARG;
     }
 
-    return (int64_t)bytes_written;
+    return stream_transfer(proc, stream, (uintptr_t)data, (size_t)size, true);
+}
+
+int64_t syscall_write(process_t *proc, int64_t stream, int64_t data, int64_t size, int64_t, int64_t, int64_t, task_state_t *)
+{
+    if (size < 0)
+    {
+        return -EINVARG;
+    }
+
+    return stream_transfer(proc, stream, (uintptr_t)data, (size_t)size, false);
 }
 
 int64_t syscall_fork(process_t *proc, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, task_state_t *state)
@@ -97,7 +166,12 @@ int64_t syscall_ping(process_t *, int64_t pid, int64_t, int64_t, int64_t, int64_
 
 int64_t syscall_exec(process_t *proc, int64_t _path, int64_t, int64_t, int64_t, int64_t, int64_t, task_state_t *)
 {
-    const char *path = process_get_pointer(proc, (uintptr_t)path);
+    char path[MAX_PATH + 13];
+    if (copy_user_string(proc, (uintptr_t)_path, path, sizeof(path)) < 0)
+    {
+        return -EINVARG;
+    }
+
     process_t *exec = process_create(path);
     if (!exec)
     {
@@ -109,7 +183,7 @@ int64_t syscall_exec(process_t *proc, int64_t _path, int64_t, int64_t, int64_t,
     process_unregister(proc);
     process_free(proc);
 
-    if (process_register(proc) < 0)
+    if (process_register(exec) < 0)
     {
         KPANIC("failed to register process");
     }
@@ -118,6 +192,175 @@ int64_t syscall_exec(process_t *proc, int64_t _path, int64_t, int64_t, int64_t,
     KPANIC("failed to execute process");
 }
 
+static uint64_t mmap_page_flags(int64_t prot)
+{
+    if (prot == MMAP_PROT_NONE)
+    {
+        return PAGE_PRESENT | PAGE_NO_EXECUTE; // kernel only, so every user access faults
+    }
+
+    uint64_t flags = PAGE_PRESENT | PAGE_USER;
+    if ((prot & MMAP_PROT_WRITE) == MMAP_PROT_WRITE)
+    {
+        flags |= PAGE_WRITABLE;
+    }
+    if ((prot & MMAP_PROT_EXEC) != MMAP_PROT_EXEC)
+    {
+        flags |= PAGE_NO_EXECUTE;
+    }
+
+    return flags;
+}
+
+// everything below PROCESS_VADDR belongs to the kernel image, whose page tables every process shares
+static bool user_range_valid(uintptr_t addr, size_t size)
+{
+    return addr % PAGE_SIZE == 0 && size > 0 && addr >= PROCESS_VADDR && addr < PROCESS_HEAP_VADDR_END && size <= PROCESS_HEAP_VADDR_END - addr;
+}
+
+int64_t syscall_mmap(process_t *proc, int64_t addr, int64_t length, int64_t prot, int64_t flags, int64_t stream, int64_t offset, task_state_t *)
+{
+    if (length <= 0 || length > PROCESS_HEAP_VADDR_END - PROCESS_HEAP_VADDR_BASE)
+    {
+        return -EINVARG;
+    }
+
+    bool anonymous = (flags & MMAP_ANONYMOUS) == MMAP_ANONYMOUS;
+    bool shared = (flags & MMAP_SHARED) == MMAP_SHARED;
+    if (shared && ((flags & MMAP_PRIVATE) == MMAP_PRIVATE || anonymous))
+    {
+        return -EINVARG; // mappings are private by default, shared anonymous memory would need a shared fork
+    }
+
+    page_cache_t *cache = NULL;
+    if (!anonymous)
+    {
+        if (!stream_valid(stream) || proc->streams[stream].type != STREAM_TYPE_FILE || offset < 0 || offset % PAGE_SIZE != 0)
+        {
+            return -EINVARG;
+        }
+
+        cache = page_cache_get(proc->streams[stream].node, shared);
+        if (!cache)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    size_t size = ((size_t)length + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    uintptr_t start = (uintptr_t)addr;
+    if ((flags & MMAP_FIXED) == MMAP_FIXED)
+    {
+        if (!user_range_valid(start, size) || start < PROCESS_HEAP_VADDR_BASE)
+        {
+            page_cache_put(cache, shared);
+            return -EINVARG;
+        }
+
+        int status = vma_unmap(proc, start, start + size); // replaces whatever was there
+        if (status < 0)
+        {
+            page_cache_put(cache, shared);
+            return status;
+        }
+    }
+    else
+    {
+        start = vma_find_free(proc, size);
+        if (start == 0)
+        {
+            page_cache_put(cache, shared);
+            return -ENOMEM;
+        }
+    }
+
+    vma_t *vma = vma_create(start, start + size, mmap_page_flags(prot), shared ? VMA_SHARED : 0);
+    if (!vma)
+    {
+        page_cache_put(cache, shared);
+        return -ENOMEM;
+    }
+
+    // pages past the end of the file fault like unmapped memory
+    vma->cache = cache;
+    vma->file_offset = (uint64_t)offset;
+    vma->file_start = start;
+    vma->file_end = start + size;
+
+    int status = vma_insert(proc, vma);
+    if (status < 0)
+    {
+        vma_free(vma);
+        return status;
+    }
+
+    return (int64_t)start;
+}
+
+int64_t syscall_munmap(process_t *proc, int64_t addr, int64_t length, int64_t, int64_t, int64_t, int64_t, task_state_t *)
+{
+    size_t size = ((size_t)length + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    if (length <= 0 || !user_range_valid((uintptr_t)addr, size))
+    {
+        return -EINVARG;
+    }
+
+    return vma_unmap(proc, (uintptr_t)addr, (uintptr_t)addr + size);
+}
+
+int64_t syscall_mprotect(process_t *proc, int64_t addr, int64_t length, int64_t prot, int64_t, int64_t, int64_t, task_state_t *)
+{
+    size_t size = ((size_t)length + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    if (length <= 0 || !user_range_valid((uintptr_t)addr, size))
+    {
+        return -EINVARG;
+    }
+
+    return vma_protect(proc, (uintptr_t)addr, (uintptr_t)addr + size, mmap_page_flags(prot));
+}
+
+int64_t syscall_open(process_t *proc, int64_t _path, int64_t action, int64_t, int64_t, int64_t, int64_t, task_state_t *)
+{
+    char path[MAX_PATH + 13];
+    if (copy_user_string(proc, (uintptr_t)_path, path, sizeof(path)) < 0 || action < OPEN_ACTION_READ || action > OPEN_ACTION_CREATE)
+    {
+        return -EINVARG;
+    }
+
+    // 0-2 are stdin, stdout and stderr
+    for (int64_t i = 3; i < PROCESS_MAX_STREAMS; i++)
+    {
+        if (proc->streams[i].type != STREAM_TYPE_NULL)
+        {
+            continue;
+        }
+
+        if (stream_create_file(&proc->streams[i], 0, path, (uint8_t)action) < 0)
+        {
+            proc->streams[i].type = STREAM_TYPE_NULL;
+            return -ERECOV;
+        }
+
+        return i;
+    }
+
+    return -ENOMEM;
+}
+
+int64_t syscall_close(process_t *proc, int64_t stream, int64_t, int64_t, int64_t, int64_t, int64_t, task_state_t *)
+{
+    if (!stream_valid(stream) || proc->streams[stream].type == STREAM_TYPE_NULL)
+    {
+        return -EINVARG;
+    }
+
+    // mappings of the file stay valid, they hold their own page cache reference
+    stream_free(&proc->streams[stream]);
+    proc->streams[stream].type = STREAM_TYPE_NULL;
+
+    return 0;
+}
+
 extern page_table_t *kernel_pml4;
 
 int64_t syscall_handler(uint64_t num, int64_t arg0, int64_t arg1, int64_t arg2, int64_t arg3, int64_t arg4, int64_t arg5, task_state_t *state)
@@ -158,6 +401,21 @@ int64_t syscall_handler(uint64_t num, int64_t arg0, int64_t arg1, int64_t arg2,
     case 5:
         res = syscall_exec(proc, arg0, arg1, arg2, arg3, arg4, arg5, state);
         break;
+    case 6:
+        res = syscall_mmap(proc, arg0, arg1, arg2, arg3, arg4, arg5, state);
+        break;
+    case 7:
+        res = syscall_munmap(proc, arg0, arg1, arg2, arg3, arg4, arg5, state);
+        break;
+    case 8:
+        res = syscall_mprotect(proc, arg0, arg1, arg2, arg3, arg4, arg5, state);
+        break;
+    case 9:
+        res = syscall_open(proc, arg0, arg1, arg2, arg3, arg4, arg5, state);
+        break;
+    case 10:
+        res = syscall_close(proc, arg0, arg1, arg2, arg3, arg4, arg5, state);
+        break;
     default:
         break;
     }
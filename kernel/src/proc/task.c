@@ -3,14 +3,60 @@
 #include <kernel/string.h>
 #include <kernel/kprintf.h>
 #include <kernel/pmm.h>
-
-extern int __kernel_start;
-extern int __kernel_end;
+#include <kernel/slab.h>
 
 static uint64_t current_pid = 0;
+
+static kmem_cache_t *process_cache = NULL;
+static kmem_cache_t *task_cache = NULL;
+
+static int process_caches_init(void)
+{
+    if (!process_cache)
+    {
+        process_cache = kmem_cache_create("process_t", sizeof(process_t), 0, NULL);
+    }
+
+    if (!task_cache)
+    {
+        task_cache = kmem_cache_create("task_t", sizeof(task_t), 0, NULL);
+    }
+
+    if (!process_cache || !task_cache)
+    {
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+// the stack starts out empty, its pages are mapped when they are first touched
+static int create_stack(process_t *proc)
+{
+    vma_t *stack = vma_create(PROCESS_STACK_VADDR_BASE, PROCESS_STACK_VADDR_BASE + PROCESS_STACK_SIZE, PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER | PAGE_NO_EXECUTE, VMA_GROWS_DOWN);
+    if (!stack)
+    {
+        return -ENOMEM;
+    }
+
+    int status = vma_insert(proc, stack);
+    if (status < 0)
+    {
+        vma_free(stack);
+        return status;
+    }
+
+    return 0;
+}
+
 process_t *process_create(const char *path)
 {
-    process_t *proc = kmalloc(sizeof(process_t));
+    if (process_caches_init() < 0)
+    {
+        return NULL;
+    }
+
+    process_t *proc = kmem_cache_alloc(process_cache);
     if (!proc)
     {
         return NULL;
@@ -25,19 +71,18 @@ process_t *process_create(const char *path)
         return NULL;
     }
 
-    proc->task = kmalloc(sizeof(task_t));
+    proc->task = kmem_cache_alloc(task_cache);
     if (!proc->task)
     {
         process_free(proc);
         return NULL;
     }
 
-    memset(&proc->task->state, 0, sizeof(task_state_t));
+    memset(proc->task, 0, sizeof(task_t));
     proc->task->state.rip = elf_entry(proc->elf);
 
     strncpy(proc->path, path, MAX_PATH);
-    proc->pml4 = pmm_alloc();
-    memset(proc->pml4, 0, PAGE_SIZE);
+    proc->pml4 = pml4_create();
     if (!proc->pml4)
     {
         process_free(proc);
@@ -46,40 +91,7 @@ process_t *process_create(const char *path)
 
     proc->task->parent = proc;
 
-    for (uintptr_t i = (uintptr_t)&__kernel_start; i < (uintptr_t)&__kernel_end; i += PAGE_SIZE)
-    {
-        if (pml4_map(proc->pml4, (void *)i, (void *)i, PAGE_PRESENT | PAGE_WRITABLE) < 0)
-        {
-            process_free(proc);
-            return NULL;
-        }
-    }
-
-    proc->task->num_stack_pages = PROCESS_STACK_SIZE / PAGE_SIZE;
-    proc->task->stack_pages = kmalloc(proc->task->num_stack_pages);
-    if (!proc->task->stack_pages)
-    {
-        process_free(proc);
-        return NULL;
-    }
-
-    for (size_t i = 0; i < proc->task->num_stack_pages; i++)
-    {
-        proc->task->stack_pages[i] = pmm_alloc();
-        if (!proc->task->stack_pages[i])
-        {
-            process_free(proc);
-            return NULL;
-        }
-
-        if (pml4_map(proc->pml4, (void *)(PROCESS_STACK_VADDR_BASE + (PROCESS_STACK_SIZE - i * PAGE_SIZE)), proc->task->stack_pages[i], PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER) < 0)
-        {
-            process_free(proc);
-            return NULL;
-        }
-    }
-
-    if (elf_load_and_map(proc, proc->elf) < 0)
+    if (create_stack(proc) < 0 || elf_map_segments(proc, proc->elf) < 0)
     {
         process_free(proc);
         return NULL;
@@ -134,40 +146,38 @@ process_t *process_create(const char *path)
         return NULL;
     }
 
-    elf_free(proc->elf);
-
     return proc;
 }
 
 process_t *process_clone(process_t *_proc)
 {
-    process_t *proc = kmalloc(sizeof(process_t));
-    if (!proc)
+    if (process_caches_init() < 0)
     {
         return NULL;
     }
 
-    memset(proc, 0, sizeof(process_t));
-
-    proc->elf = elf_load(_proc->path);
-    if (!proc->elf)
+    process_t *proc = kmem_cache_alloc(process_cache);
+    if (!proc)
     {
-        process_free(proc);
         return NULL;
     }
 
-    proc->task = kmalloc(sizeof(task_t));
+    memset(proc, 0, sizeof(process_t));
+
+    proc->elf = elf_ref(_proc->elf);
+
+    proc->task = kmem_cache_alloc(task_cache);
     if (!proc->task)
     {
         process_free(proc);
         return NULL;
     }
 
+    memset(proc->task, 0, sizeof(task_t));
     memcpy(&proc->task->state, &_proc->task->state, sizeof(task_state_t));
 
     strncpy(proc->path, _proc->path, MAX_PATH);
-    proc->pml4 = pmm_alloc();
-    memset(proc->pml4, 0, PAGE_SIZE);
+    proc->pml4 = pml4_create();
     if (!proc->pml4)
     {
         process_free(proc);
@@ -176,42 +186,7 @@ process_t *process_clone(process_t *_proc)
 
     proc->task->parent = proc;
 
-    for (uintptr_t i = (uintptr_t)&__kernel_start; i < (uintptr_t)&__kernel_end; i += PAGE_SIZE)
-    {
-        if (pml4_map(proc->pml4, (void *)i, (void *)i, PAGE_PRESENT | PAGE_WRITABLE) < 0)
-        {
-            process_free(proc);
-            return NULL;
-        }
-    }
-
-    proc->task->num_stack_pages = _proc->task->num_stack_pages;
-    proc->task->stack_pages = kmalloc(proc->task->num_stack_pages);
-    if (!proc->task->stack_pages)
-    {
-        process_free(proc);
-        return NULL;
-    }
-
-    for (size_t i = 0; i < proc->task->num_stack_pages; i++)
-    {
-        proc->task->stack_pages[i] = pmm_alloc();
-        if (!proc->task->stack_pages[i])
-        {
-            process_free(proc);
-            return NULL;
-        }
-
-        memcpy(proc->task->stack_pages[i], _proc->task->stack_pages[i], PAGE_SIZE);
-
-        if (pml4_map(proc->pml4, (void *)(PROCESS_STACK_VADDR_BASE + (PROCESS_STACK_SIZE - i * PAGE_SIZE)), proc->task->stack_pages[i], PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER) < 0)
-        {
-            process_free(proc);
-            return NULL;
-        }
-    }
-
-    if (elf_load_and_map_copy(proc, proc->elf, _proc) < 0)
+    if (vma_clone_all(proc, _proc) < 0)
     {
         process_free(proc);
         return NULL;
@@ -234,8 +209,6 @@ process_t *process_clone(process_t *_proc)
     proc->next = NULL;
     proc->pid = current_pid++;
 
-    elf_free(proc->elf);
-    
     return proc;
 }
 
@@ -246,33 +219,18 @@ void process_free(process_t *proc)
         return;
     }
 
-    if (proc->elf)
-    {
-        elf_free(proc->elf);
-    }
+    vma_free_all(proc);
     if (proc->pml4)
     {
-        pmm_free((uint64_t *)proc->pml4);
+        pml4_destroy(proc->pml4);
     }
-    if (proc->data_pages)
-    {
-        for (size_t i = 0; i < proc->num_data_pages; i++)
-        {
-            pmm_free(proc->data_pages[i]);
-        }
-        kfree(proc->data_pages);
-    }
-    if (proc->task && proc->task->stack_pages)
+    if (proc->elf)
     {
-        for (size_t i = 0; i < proc->task->num_stack_pages; i++)
-        {
-            pmm_free(proc->task->stack_pages[i]);
-        }
-        kfree(proc->task->stack_pages);
+        elf_free(proc->elf);
     }
     if (proc->task)
     {
-        kfree(proc->task);
+        kmem_cache_free(task_cache, proc->task);
     }
 
     for (int i = 0; i < PROCESS_MAX_STREAMS; i++)
@@ -283,7 +241,7 @@ void process_free(process_t *proc)
         }
     }
 
-    kfree(proc);
+    kmem_cache_free(process_cache, proc);
 }
 
 process_t *proc_head = NULL;
@@ -0,0 +1,516 @@
+#include <kernel/proc/vma.h>
+#include <kernel/proc/task.h>
+#include <kernel/pmm.h>
+#include <kernel/slab.h>
+#include <kernel/string.h>
+
+#define VMA_STACK_GUARD_SIZE PAGE_SIZE // gap the stack keeps to the area below it
+
+static kmem_cache_t *vma_cache = NULL;
+
+vma_t *vma_create(uintptr_t start, uintptr_t end, uint64_t page_flags, uint8_t flags)
+{
+    if (start >= end || start % PAGE_SIZE != 0 || end % PAGE_SIZE != 0)
+    {
+        return NULL;
+    }
+
+    if (!vma_cache)
+    {
+        vma_cache = kmem_cache_create("vma_t", sizeof(vma_t), 0, NULL);
+        if (!vma_cache)
+        {
+            return NULL;
+        }
+    }
+
+    vma_t *vma = kmem_cache_alloc(vma_cache);
+    if (!vma)
+    {
+        return NULL;
+    }
+
+    memset(vma, 0, sizeof(vma_t));
+    vma->start = start;
+    vma->end = end;
+    vma->page_flags = page_flags;
+    vma->flags = flags;
+
+    return vma;
+}
+
+void vma_free(vma_t *vma)
+{
+    if (vma)
+    {
+        page_cache_put(vma->cache, (vma->flags & VMA_SHARED) == VMA_SHARED);
+        kmem_cache_free(vma_cache, vma);
+    }
+}
+
+int vma_insert(process_t *proc, vma_t *vma)
+{
+    if (!proc || !vma)
+    {
+        return -EINVARG;
+    }
+
+    vma_t *prev = NULL;
+    vma_t *next = proc->vmas;
+    while (next && next->start < vma->start)
+    {
+        prev = next;
+        next = next->next;
+    }
+
+    if ((prev && prev->end > vma->start) || (next && next->start < vma->end))
+    {
+        return -EINVARG;
+    }
+
+    vma->next = next;
+    if (prev)
+    {
+        prev->next = vma;
+    }
+    else
+    {
+        proc->vmas = vma;
+    }
+
+    return 0;
+}
+
+vma_t *vma_find(process_t *proc, uintptr_t addr)
+{
+    for (vma_t *vma = proc->vmas; vma && vma->start <= addr; vma = vma->next)
+    {
+        if (addr < vma->end)
+        {
+            return vma;
+        }
+    }
+
+    return NULL;
+}
+
+uintptr_t vma_find_free(process_t *proc, size_t size)
+{
+    uintptr_t addr = PROCESS_HEAP_VADDR_BASE;
+    for (vma_t *vma = proc->vmas; vma && vma->start < addr + size; vma = vma->next)
+    {
+        if (vma->end > addr)
+        {
+            addr = vma->end;
+        }
+    }
+
+    if (size > PROCESS_HEAP_VADDR_END - addr)
+    {
+        return 0;
+    }
+
+    return addr;
+}
+
+static vma_t *copy_vma(vma_t *vma, uintptr_t start, uintptr_t end)
+{
+    vma_t *copy = vma_create(start, end, vma->page_flags, vma->flags);
+    if (!copy)
+    {
+        return NULL;
+    }
+
+    copy->file = vma->file;
+    copy->file_offset = vma->file_offset;
+    copy->file_start = vma->file_start;
+    copy->file_end = vma->file_end;
+    if (vma->cache)
+    {
+        copy->cache = page_cache_ref(vma->cache, (vma->flags & VMA_SHARED) == VMA_SHARED);
+    }
+
+    return copy;
+}
+
+// splits the area so addr becomes a boundary, returns the upper part
+static vma_t *split(vma_t *vma, uintptr_t addr)
+{
+    vma_t *upper = copy_vma(vma, addr, vma->end);
+    if (!upper)
+    {
+        return NULL;
+    }
+
+    upper->next = vma->next;
+    vma->next = upper;
+    vma->end = addr;
+
+    return upper;
+}
+
+// areas are mapped lazily, so this only costs something for the pages that were touched
+static void release_pages(process_t *proc, vma_t *vma)
+{
+    pml4_release_range(proc->pml4, (void *)vma->start, (vma->end - vma->start) / PAGE_SIZE);
+}
+
+int vma_unmap(process_t *proc, uintptr_t start, uintptr_t end)
+{
+    if (start % PAGE_SIZE != 0 || end % PAGE_SIZE != 0 || start >= end)
+    {
+        return -EINVARG;
+    }
+
+    vma_t **link = &proc->vmas;
+    while (*link && (*link)->start < end)
+    {
+        vma_t *vma = *link;
+        if (vma->end <= start)
+        {
+            link = &vma->next;
+            continue;
+        }
+
+        if (vma->start < start)
+        {
+            if (!split(vma, start))
+            {
+                return -ENOMEM;
+            }
+            link = &vma->next;
+            continue;
+        }
+
+        if (vma->end > end && !split(vma, end))
+        {
+            return -ENOMEM;
+        }
+
+        release_pages(proc, vma);
+        *link = vma->next;
+        vma_free(vma);
+    }
+
+    return 0;
+}
+
+int vma_protect(process_t *proc, uintptr_t start, uintptr_t end, uint64_t page_flags)
+{
+    if (start % PAGE_SIZE != 0 || end % PAGE_SIZE != 0 || start >= end)
+    {
+        return -EINVARG;
+    }
+
+    uintptr_t covered = start;
+    for (vma_t *vma = proc->vmas; vma && vma->start <= covered && covered < end; vma = vma->next)
+    {
+        if (vma->end > covered)
+        {
+            covered = vma->end;
+        }
+    }
+
+    if (covered < end)
+    {
+        return -EINVARG;
+    }
+
+    for (vma_t *vma = proc->vmas; vma && vma->start < end; vma = vma->next)
+    {
+        if (vma->end <= start)
+        {
+            continue;
+        }
+
+        if (vma->start < start)
+        {
+            if (!split(vma, start))
+            {
+                return -ENOMEM;
+            }
+            continue;
+        }
+
+        if (vma->end > end && !split(vma, end))
+        {
+            return -ENOMEM;
+        }
+
+        // pages only become writable on their first write fault, that keeps copy on write sharing intact
+        vma->page_flags = page_flags;
+        int status = pml4_protect_range(proc->pml4, (void *)vma->start, (vma->end - vma->start) / PAGE_SIZE, page_flags & ~PAGE_WRITABLE);
+        if (status < 0)
+        {
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+// extends the stack above page down to it, as long as it stays below the maximum size and keeps its guard gap
+static vma_t *grow_stack(process_t *proc, uintptr_t page)
+{
+    vma_t *prev = NULL;
+    vma_t *vma = proc->vmas;
+    while (vma && vma->end <= page)
+    {
+        prev = vma;
+        vma = vma->next;
+    }
+
+    if (!vma || (vma->flags & VMA_GROWS_DOWN) != VMA_GROWS_DOWN || page >= vma->start)
+    {
+        return NULL;
+    }
+
+    if (vma->end - page > PROCESS_STACK_MAX_SIZE || (prev && page < prev->end + VMA_STACK_GUARD_SIZE))
+    {
+        return NULL;
+    }
+
+    vma->start = page;
+    return vma;
+}
+
+static int read_file_page(vma_t *vma, uintptr_t page, uint8_t *buf, uintptr_t start, uintptr_t end)
+{
+    memset(buf, 0, start - page);
+    memset(buf + (end - page), 0, page + PAGE_SIZE - end);
+
+    uint64_t offset = vma->file_offset + (start - vma->file_start);
+    if (vma->cache)
+    {
+        // the cache reads ahead, so this costs one large read per few pages
+        while (start < end)
+        {
+            uint8_t *src = page_cache_get_page(vma->cache, offset / PAGE_SIZE);
+            if (!src)
+            {
+                return -ERECOV;
+            }
+
+            size_t size = end - start < PAGE_SIZE - offset % PAGE_SIZE ? end - start : PAGE_SIZE - offset % PAGE_SIZE;
+            memcpy(buf + (start - page), src + offset % PAGE_SIZE, size);
+            start += size;
+            offset += size;
+        }
+
+        return 0;
+    }
+
+    int status = vfs_seek(vma->file, offset, SEEK_TYPE_SET);
+    if (status < 0)
+    {
+        return status;
+    }
+
+    return vfs_read(vma->file, end - start, buf + (start - page));
+}
+
+// after a fork both processes map the page read-only, the last one holding it can keep it
+static int copy_on_write(process_t *proc, vma_t *vma, uintptr_t page)
+{
+    uint64_t phys = pml4_get_phys(proc->pml4, (void *)page, true);
+    if (pmm_get_refs((void *)phys) == 1)
+    {
+        return pml4_protect_range(proc->pml4, (void *)page, 1, vma->page_flags);
+    }
+
+    void *copy = pmm_alloc();
+    if (!copy)
+    {
+        return -ENOMEM;
+    }
+
+    memcpy(copy, (void *)phys, PAGE_SIZE);
+
+    int status = pml4_map(proc->pml4, (void *)page, copy, vma->page_flags);
+    if (status < 0)
+    {
+        pmm_free(copy);
+        return status;
+    }
+
+    pmm_free((uint64_t *)phys);
+    return 0;
+}
+
+// maps the page of the cache, private areas get it read-only so the first write copies it
+static int map_cached_page(process_t *proc, vma_t *vma, uintptr_t page, bool write)
+{
+    void *phys = page_cache_get_page(vma->cache, (vma->file_offset + (page - vma->file_start)) / PAGE_SIZE);
+    if (!phys)
+    {
+        return -EINVARG; // past the end of the file
+    }
+
+    bool shared = (vma->flags & VMA_SHARED) == VMA_SHARED;
+    if (write && !shared)
+    {
+        // the allocation may run the page cache shrinker, which would take the page away otherwise
+        int status = pmm_ref(phys);
+        if (status < 0)
+        {
+            return status;
+        }
+
+        void *copy = pmm_alloc();
+        if (copy)
+        {
+            memcpy(copy, phys, PAGE_SIZE);
+        }
+        pmm_free(phys);
+
+        if (!copy)
+        {
+            return -ENOMEM;
+        }
+
+        status = pml4_map(proc->pml4, (void *)page, copy, vma->page_flags);
+        if (status < 0)
+        {
+            pmm_free(copy);
+        }
+        return status;
+    }
+
+    int status = pmm_ref(phys);
+    if (status < 0)
+    {
+        return status;
+    }
+
+    // shared pages are mapped writable on the first write, which marks the cache dirty
+    status = pml4_map(proc->pml4, (void *)page, phys, write ? vma->page_flags : vma->page_flags & ~PAGE_WRITABLE);
+    if (status < 0)
+    {
+        pmm_free(phys);
+        return status;
+    }
+
+    if (write)
+    {
+        vma->cache->dirty = true;
+    }
+
+    return 0;
+}
+
+int vma_fault(process_t *proc, uintptr_t addr, bool write)
+{
+    if (!proc)
+    {
+        return -EINVARG;
+    }
+
+    uintptr_t page = addr & ~(uintptr_t)(PAGE_SIZE - 1);
+    vma_t *vma = vma_find(proc, addr);
+    if (!vma)
+    {
+        vma = grow_stack(proc, page);
+        if (!vma)
+        {
+            return -EINVARG;
+        }
+    }
+
+    if ((vma->page_flags & PAGE_USER) != PAGE_USER || (write && (vma->page_flags & PAGE_WRITABLE) != PAGE_WRITABLE))
+    {
+        return -EINVARG; // also catches areas mapped without any access
+    }
+
+    uint64_t mapped_flags = pml4_get_flags(proc->pml4, (void *)page);
+    if ((mapped_flags & PAGE_PRESENT) == PAGE_PRESENT)
+    {
+        if (!write || (mapped_flags & PAGE_WRITABLE) == PAGE_WRITABLE)
+        {
+            return 0;
+        }
+
+        if ((vma->flags & VMA_SHARED) == VMA_SHARED)
+        {
+            vma->cache->dirty = true;
+            return pml4_protect_range(proc->pml4, (void *)page, 1, vma->page_flags);
+        }
+
+        return copy_on_write(proc, vma, page);
+    }
+
+    if (vma->cache && !vma->file)
+    {
+        return map_cached_page(proc, vma, page, write);
+    }
+
+    // the part of the page that comes from the file, empty for bss and anonymous memory
+    uintptr_t file_start = page > vma->file_start ? page : vma->file_start;
+    uintptr_t file_end = page + PAGE_SIZE < vma->file_end ? page + PAGE_SIZE : vma->file_end;
+    bool file_backed = vma->file && file_start < file_end;
+
+    uint8_t *phys = file_backed ? pmm_alloc() : pmm_alloc_zeroed();
+    if (!phys)
+    {
+        return -ENOMEM;
+    }
+
+    if (file_backed)
+    {
+        int status = read_file_page(vma, page, phys, file_start, file_end);
+        if (status < 0)
+        {
+            pmm_free((uint64_t *)phys);
+            return status;
+        }
+    }
+
+    int status = pml4_map(proc->pml4, (void *)page, phys, vma->page_flags);
+    if (status < 0)
+    {
+        pmm_free((uint64_t *)phys);
+        return status;
+    }
+
+    return 0;
+}
+
+int vma_clone_all(process_t *proc, process_t *original)
+{
+    vma_t **tail = &proc->vmas;
+    for (vma_t *vma = original->vmas; vma; vma = vma->next)
+    {
+        vma_t *copy = copy_vma(vma, vma->start, vma->end);
+        if (!copy)
+        {
+            return -ENOMEM;
+        }
+
+        *tail = copy;
+        tail = &copy->next;
+
+        // no page is copied here, writable ones turn read-only in both processes until the first write
+        int status = pml4_share_range(proc->pml4, original->pml4, (void *)vma->start, (vma->end - vma->start) / PAGE_SIZE, vma->page_flags & ~PAGE_WRITABLE);
+        if (status < 0)
+        {
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+void vma_free_all(process_t *proc)
+{
+    while (proc->vmas)
+    {
+        vma_t *vma = proc->vmas;
+        proc->vmas = vma->next;
+
+        if (proc->pml4)
+        {
+            release_pages(proc, vma);
+        }
+
+        vma_free(vma);
+    }
+}
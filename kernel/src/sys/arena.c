@@ -0,0 +1,113 @@
+#include <kernel/arena.h>
+#include <kernel/pmm.h>
+#include <kernel/cpu.h>
+#include <kernel/string.h>
+
+// blocks are stacked, the newest one is the one allocations are bumped in
+typedef struct arena_block
+{
+    struct arena_block *prev;
+    uint8_t order;
+} arena_block_t;
+
+#define ARENA_HEADER_SIZE ((sizeof(arena_block_t) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+typedef struct
+{
+    arena_block_t *top;
+    size_t offset; // into top
+} cpu_arena_t;
+
+static cpu_arena_t arenas[MAX_CPUS];
+
+static size_t block_size(arena_block_t *block)
+{
+    return (size_t)PAGE_SIZE << block->order;
+}
+
+static arena_block_t *push_block(cpu_arena_t *arena, size_t min_size)
+{
+    uint8_t order = ARENA_BLOCK_ORDER;
+    while (((size_t)PAGE_SIZE << order) < min_size + ARENA_HEADER_SIZE)
+    {
+        order++;
+    }
+
+    if (order > PMM_MAX_ORDER)
+    {
+        return NULL;
+    }
+
+    arena_block_t *block = pmm_alloc_pages(order);
+    if (!block)
+    {
+        return NULL;
+    }
+
+    block->prev = arena->top;
+    block->order = order;
+    arena->top = block;
+    arena->offset = ARENA_HEADER_SIZE;
+
+    return block;
+}
+
+arena_t arena_begin(void)
+{
+    cpu_arena_t *arena = &arenas[cpu_get_id()];
+
+    // the first block is kept for good, so the common case never reaches the pmm
+    if (!arena->top)
+    {
+        push_block(arena, 0);
+    }
+
+    arena_t res = {arena->top, arena->offset};
+    return res;
+}
+
+void *arena_alloc(size_t size)
+{
+    cpu_arena_t *arena = &arenas[cpu_get_id()];
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    if (!arena->top || arena->offset + size > block_size(arena->top))
+    {
+        if (!push_block(arena, size))
+        {
+            return NULL;
+        }
+    }
+
+    void *res = (uint8_t *)arena->top + arena->offset;
+    arena->offset += size;
+    return res;
+}
+
+char *arena_strdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *res = arena_alloc(len);
+    if (!res)
+    {
+        return NULL;
+    }
+
+    memcpy(res, str, len);
+    return res;
+}
+
+void arena_end(arena_t scope)
+{
+    cpu_arena_t *arena = &arenas[cpu_get_id()];
+
+    // blocks pushed inside the scope go back to the pmm
+    while (arena->top && arena->top != scope.block)
+    {
+        arena_block_t *block = arena->top;
+        arena->top = block->prev;
+        pmm_free_pages(block, block->order);
+    }
+
+    arena->offset = arena->top ? scope.offset : 0;
+}
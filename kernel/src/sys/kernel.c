@@ -8,6 +8,7 @@
 #include <kernel/pmm.h>
 #include <kernel/vmm.h>
 #include <kernel/kmm.h>
+#include <kernel/vmalloc.h>
 #include <kernel/fs/vpt.h>
 #include <kernel/fs/vfs.h>
 #include <kernel/proc/task.h>
@@ -176,24 +177,22 @@ void kmain(uint64_t multiboot2_struct_addr)
         return;
     }
 
-    if (pmm_init(boot_info.memory_map, boot_info.num_mmap_entries, boot_info.total_memory) < 0) // TODO: add 64 bit address range
+    if (pmm_init(boot_info.memory_map, boot_info.num_mmap_entries, boot_info.total_memory) < 0)
     {
         return;
     }
     
-    kernel_pml4 = pmm_alloc();
+    kernel_pml4 = pmm_alloc_zeroed();
     if (!kernel_pml4)
     {
         return;
     }
     
+    // identity map all of ram, with 1 GiB or 2 MiB pages wherever possible
     uint64_t total_pages = boot_info.total_memory / PAGE_SIZE;
-    for (uint64_t page = 0; page < total_pages; page++)
+    if (pml4_map_range(kernel_pml4, (void *)0, (void *)0, total_pages, PAGE_PRESENT | PAGE_WRITABLE) < 0)
     {
-        if (pml4_map(kernel_pml4, (void *)(page * PAGE_SIZE), (void *)(page * PAGE_SIZE), PAGE_PRESENT | PAGE_WRITABLE) < 0)
-        {
-            return;
-        }
+        return;
     }
 
     if (pml4_switch(kernel_pml4) < 0)
@@ -201,7 +200,19 @@ void kmain(uint64_t multiboot2_struct_addr)
         return;
     }
 
-    if (kmm_init(kernel_pml4, 0x1200000, 32 * PAGE_SIZE, 16) < 0) // TODO: make dynamicly grow
+    pmm_set_mapped_limit(boot_info.total_memory);
+
+    if (vmm_init(kernel_pml4) < 0)
+    {
+        return;
+    }
+
+    if (kmm_init(kernel_pml4, 16) < 0)
+    {
+        return;
+    }
+
+    if (vmalloc_init(kernel_pml4) < 0)
     {
         return;
     }
@@ -222,6 +233,8 @@ void kmain(uint64_t multiboot2_struct_addr)
         return;
     }
 
+    pmm_zero_pool_init();
+
     enable_interrupts();
 
     if (init_devices() < 0)
@@ -229,6 +242,9 @@ void kmain(uint64_t multiboot2_struct_addr)
         return;
     }
 
+    // no acpi tables are parsed yet, so the reclaimable memory can be handed out right away
+    pmm_reclaim_acpi_memory();
+
     if (kprintf_init(get_chardev(boot_info.tty)) < 0)
     {
         return;
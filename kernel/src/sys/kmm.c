@@ -1,116 +1,298 @@
 #include <kernel/kmm.h>
 #include <kernel/pmm.h>
+#include <kernel/arena.h>
 #include <kernel/string.h>
+#include <kernel/kprintf.h>
 #include <stdbool.h>
 
-#define MAX_LEVEL 12
-
+#ifdef KMM_PROFILE
+#define PROFILE_ALLOC(ptr, size) kmm_profile_alloc(ptr, size, __builtin_return_address(0))
+#define PROFILE_FREE(ptr) kmm_profile_free(ptr)
+#else
+#define PROFILE_ALLOC(ptr, size)
+#define PROFILE_FREE(ptr)
+#endif
+
+#define KMM_MAX_ORDERS 32
+#define KMM_NUM_SLOTS (KMM_HEAP_MAX_SIZE / KMM_CHUNK_MAX_SIZE)
+
+/*
+ the heap is a set of chunks, each one a buddy allocator of its own.
+ a chunk lives in its own KMM_CHUNK_MAX_SIZE slot of the reserved range, so it is naturally aligned
+ and the buddy of a block is found by flipping the bit of its size in the address.
+ every block starts with a header of `alignment` bytes, the returned pointer follows it.
+ free blocks additionally keep their free list links right behind the header.
+*/
 typedef struct buddy_node
 {
-    size_t size;
+    uint8_t order;
     bool free;
 } buddy_node_t;
 
-buddy_node_t *buddy_node_next(buddy_node_t *node)
+typedef struct free_node
+{
+    struct free_node *prev;
+    struct free_node *next;
+} free_node_t;
+
+typedef struct
+{
+    bool used;
+    uint8_t order;
+} chunk_t;
+
+struct
 {
-    return (buddy_node_t *)((uintptr_t)node + node->size);
+    page_table_t *pml4;
+    size_t alignment;
+    size_t min_block_size;
+    uint8_t max_order;
+    free_node_t *free_lists[KMM_MAX_ORDERS];
+    chunk_t chunks[KMM_NUM_SLOTS];
+    size_t empty_chunks;
+    kmm_stats_t stats;
+} heap;
+
+/*
+ allocations up to KMM_SMALL_MAX bytes are rounded up to a size class and packed into runs,
+ naturally aligned blocks of KMM_RUN_SIZE bytes from the pmm with a free bitmap in front.
+ runs are outside the heap range, which is how kfree tells them apart from buddy blocks.
+*/
+#define KMM_SMALL_MAX 2048
+#define KMM_SMALL_ALIGN 32
+#define KMM_NUM_SIZE_CLASSES 12
+#define KMM_RUN_ORDER 2
+#define KMM_RUN_SIZE (PAGE_SIZE << KMM_RUN_ORDER)
+#define KMM_RUN_BITMAP_WORDS 8
+#define KMM_RUN_HEADER_SIZE 96
+#define KMM_RUN_MAGIC 0x52554e53 // tells runs apart from pointers that never came from kmalloc
+#define KMM_MAX_EMPTY_RUNS 1
+
+typedef struct run
+{
+    struct run *prev;
+    struct run *next;
+    uint8_t size_class;
+    uint8_t summary; // bit n set if free[n] is not zero
+    uint16_t num_free;
+    uint32_t magic;
+    uint64_t free[KMM_RUN_BITMAP_WORDS]; // bit set if the slot is free
+} run_t;
+
+static const uint16_t size_classes[KMM_NUM_SIZE_CLASSES] = {32, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048};
+
+typedef struct
+{
+    run_t *partial; // runs with at least one free slot
+    size_t empty_runs;
+} size_class_t;
+
+struct
+{
+    size_class_t classes[KMM_NUM_SIZE_CLASSES];
+    uint8_t class_of[KMM_SMALL_MAX / KMM_SMALL_ALIGN + 1]; // indexed by size in KMM_SMALL_ALIGN steps
+} small;
+
+static size_t block_size(uint8_t order)
+{
+    return heap.min_block_size << order;
 }
 
-buddy_node_t *buddy_node_split(buddy_node_t *node, size_t size)
+static free_node_t *block_links(buddy_node_t *node)
 {
-    if (!node || size == 0)
+    return (free_node_t *)((uintptr_t)node + heap.alignment);
+}
+
+static buddy_node_t *links_block(free_node_t *links)
+{
+    return (buddy_node_t *)((uintptr_t)links - heap.alignment);
+}
+
+static void free_list_push(buddy_node_t *node, uint8_t order)
+{
+    free_node_t *links = block_links(node);
+
+    node->order = order;
+    node->free = true;
+
+    links->prev = NULL;
+    links->next = heap.free_lists[order];
+    if (links->next)
     {
-        return NULL;
+        links->next->prev = links;
     }
+    heap.free_lists[order] = links;
+}
+
+static void free_list_remove(buddy_node_t *node)
+{
+    free_node_t *links = block_links(node);
 
-    while (size < node->size)
+    if (links->prev)
     {
-        size_t new_size = node->size >> 1;
-        node->size = new_size;
-        node = buddy_node_next(node);
-        node->size = new_size;
-        node->free = true;
+        links->prev->next = links->next;
+    }
+    else
+    {
+        heap.free_lists[node->order] = links->next;
     }
 
-    if (size <= node->size)
+    if (links->next)
     {
-        return node;
+        links->next->prev = links->prev;
     }
 
-    return NULL;
+    node->free = false;
 }
 
-buddy_node_t *buddy_node_find_best(buddy_node_t *head, buddy_node_t *tail, size_t size)
+static buddy_node_t *buddy_of(buddy_node_t *node, uint8_t order)
 {
-    buddy_node_t *res = NULL;
-    buddy_node_t *node = head;
-    buddy_node_t *buddy = buddy_node_next(node);
+    return (buddy_node_t *)((uintptr_t)node ^ block_size(order));
+}
 
-    if (buddy == tail && node->free)
+static size_t slot_of(void *addr)
+{
+    return ((uintptr_t)addr - KMM_HEAP_START) / KMM_CHUNK_MAX_SIZE;
+}
+
+static bool in_heap_range(void *ptr)
+{
+    return (uintptr_t)ptr >= KMM_HEAP_START && (uintptr_t)ptr < KMM_HEAP_START + KMM_HEAP_MAX_SIZE;
+}
+
+static void *slot_base(size_t slot)
+{
+    return (void *)(KMM_HEAP_START + slot * KMM_CHUNK_MAX_SIZE);
+}
+
+static void update_peak_stats(void)
+{
+    if (heap.stats.used > heap.stats.peak_used)
     {
-        return buddy_node_split(node, size);
+        heap.stats.peak_used = heap.stats.used;
     }
 
-    while (node < tail && buddy < tail)
+    if (heap.stats.mapped > heap.stats.peak_mapped)
     {
-        if (node->free && buddy->free && node->size == buddy->size)
-        {
-            node->size <<= 1;
-            if (size <= node->size && (!res || node->size <= res->size))
-            {
-                res = node;
-            }
-
-            node = buddy_node_next(buddy);
-            if (node < tail)
-            {
-                buddy = buddy_node_next(node);
-            }
-            continue;
-        }
+        heap.stats.peak_mapped = heap.stats.mapped;
+    }
+}
 
-        if (node->free && size <= node->size &&
-            (!res || node->size <= res->size))
+static void unmap_chunk_pages(void *base, size_t num_pages)
+{
+    for (size_t i = 0; i < num_pages; i++)
+    {
+        uint64_t phys = pml4_get_phys(heap.pml4, (void *)((uintptr_t)base + i * PAGE_SIZE), false);
+        if (phys != 0)
         {
-            res = node;
+            pmm_free((uint64_t *)phys);
         }
+    }
 
-        if (buddy->free && size <= buddy->size &&
-            (!res || buddy->size < res->size))
-        {
-            res = buddy;
-        }
+    pml4_unmap_range(heap.pml4, base, num_pages);
+}
 
-        if (node->size <= buddy->size)
+// maps a new chunk that can hold a block of the given order and puts it on the free lists
+static int grow_heap(uint8_t order)
+{
+    size_t size = block_size(order);
+    if (size < KMM_CHUNK_MIN_SIZE)
+    {
+        size = KMM_CHUNK_MIN_SIZE;
+    }
+
+    if (size > KMM_CHUNK_MAX_SIZE)
+    {
+        return -EINVARG;
+    }
+
+    size_t slot = 0;
+    while (slot < KMM_NUM_SLOTS && heap.chunks[slot].used)
+    {
+        slot++;
+    }
+
+    if (slot == KMM_NUM_SLOTS)
+    {
+        return -ENOMEM;
+    }
+
+    void *base = slot_base(slot);
+    size_t num_pages = size / PAGE_SIZE;
+
+    arena_t scratch = arena_begin();
+    void **pages = arena_alloc(num_pages * sizeof(void *));
+    if (!pages)
+    {
+        arena_end(scratch);
+        return -ENOMEM;
+    }
+
+    for (size_t i = 0; i < num_pages; i++)
+    {
+        pages[i] = pmm_alloc();
+        if (!pages[i])
         {
-            node = buddy_node_next(buddy);
-            if (node < tail)
+            while (i-- > 0)
             {
-                buddy = buddy_node_next(node);
+                pmm_free(pages[i]);
             }
+            arena_end(scratch);
+            return -ENOMEM;
         }
-        else
+    }
+
+    int status = pml4_map_pages(heap.pml4, base, pages, num_pages, PAGE_PRESENT | PAGE_WRITABLE | PAGE_NO_EXECUTE);
+    if (status < 0)
+    {
+        for (size_t i = 0; i < num_pages; i++)
         {
-            node = buddy;
-            buddy = buddy_node_next(buddy);
+            pmm_free(pages[i]);
         }
+        pml4_unmap_range(heap.pml4, base, num_pages);
+        arena_end(scratch);
+        return status;
     }
+    arena_end(scratch);
 
-    if (res != NULL)
+    uint8_t chunk_order = 0;
+    while (block_size(chunk_order) < size)
     {
-        return buddy_node_split(res, size);
+        chunk_order++;
     }
 
-    return NULL;
+    heap.chunks[slot].used = true;
+    heap.chunks[slot].order = chunk_order;
+    heap.empty_chunks++;
+    free_list_push((buddy_node_t *)base, chunk_order);
+
+    heap.stats.chunks++;
+    heap.stats.mapped += size;
+    update_peak_stats();
+
+    return 0;
 }
 
-buddy_node_t *head;
-buddy_node_t *tail;
-size_t alignment;
+// the chunk has to be completely free
+static size_t release_chunk(size_t slot)
+{
+    buddy_node_t *node = slot_base(slot);
+    size_t size = block_size(heap.chunks[slot].order);
+
+    free_list_remove(node);
+    unmap_chunk_pages(node, size / PAGE_SIZE);
+
+    heap.chunks[slot].used = false;
+    heap.empty_chunks--;
+    heap.stats.chunks--;
+    heap.stats.mapped -= size;
 
-int kmm_init(page_table_t *kernel_pml4, uint64_t base, size_t size, size_t _alignment)
+    return size / PAGE_SIZE;
+}
+
+int kmm_init(page_table_t *kernel_pml4, size_t _alignment)
 {
-    if (!kernel_pml4 || base == 0 || (size & (size - 1)) != 0 || (_alignment & (_alignment - 1)) != 0)
+    if (!kernel_pml4 || (_alignment & (_alignment - 1)) != 0 || _alignment > KMM_CHUNK_MIN_SIZE / 2)
     {
         return -EINVARG;
     }
@@ -120,163 +302,520 @@ int kmm_init(page_table_t *kernel_pml4, uint64_t base, size_t size, size_t _alig
         _alignment = sizeof(buddy_node_t);
     }
 
-    if (((uintptr_t)base % _alignment) != 0)
+    // a free block has to hold its header and its free list links
+    size_t min_block_size = _alignment;
+    while (min_block_size < _alignment + sizeof(free_node_t))
     {
-        return -EINVARG;
+        min_block_size <<= 1;
     }
 
-    for (size_t i = 0; i < size / PAGE_SIZE; i++)
+    if (vmm_share_kernel_range((void *)KMM_HEAP_START, KMM_HEAP_MAX_SIZE) < 0)
     {
-        void *page = pmm_alloc();
-        if (!page)
-        {
-            return -ENOMEM;
-        }
+        return -ENOMEM;
+    }
 
-        int status = pml4_map(kernel_pml4, (void *)(base + i * PAGE_SIZE), page, PAGE_PRESENT | PAGE_WRITABLE);
-        if (status < 0)
+    memset(&heap, 0, sizeof(heap));
+    memset(&small, 0, sizeof(small));
+    heap.pml4 = kernel_pml4;
+    heap.alignment = _alignment;
+    heap.min_block_size = min_block_size;
+    while (block_size(heap.max_order) < KMM_CHUNK_MAX_SIZE)
+    {
+        heap.max_order++;
+    }
+
+    uint8_t size_class = 0;
+    for (size_t i = 0; i <= KMM_SMALL_MAX / KMM_SMALL_ALIGN; i++)
+    {
+        while (size_classes[size_class] < i * KMM_SMALL_ALIGN)
         {
-            return status;
+            size_class++;
         }
+        small.class_of[i] = size_class;
     }
 
-    head = (buddy_node_t *)base;
-    head->size = size;
-    head->free = true;
+    if (grow_heap(0) < 0)
+    {
+        return -ENOMEM;
+    }
 
-    tail = buddy_node_next(head);
+    return pmm_register_shrinker(kmm_shrink);
+}
 
-    alignment = _alignment;
+static uint8_t order_for_size(size_t size)
+{
+    uint8_t order = 0;
+    while (block_size(order) < size + heap.alignment)
+    {
+        order++;
+    }
 
-    return 0;
+    return order;
 }
 
-size_t align_forward_size(size_t ptr, size_t align)
+static buddy_node_t *take_free_block(uint8_t order)
 {
-    size_t a, p, modulo;
+    uint8_t found_order = order;
+    while (found_order <= heap.max_order && !heap.free_lists[found_order])
+    {
+        found_order++;
+    }
+
+    if (found_order > heap.max_order)
+    {
+        return NULL;
+    }
 
-    a = align;
-    p = ptr;
-    modulo = p & (a - 1);
-    if (modulo != 0)
+    buddy_node_t *node = links_block(heap.free_lists[found_order]);
+    free_list_remove(node);
+    if (found_order == heap.chunks[slot_of(node)].order)
     {
-        p += a - modulo;
+        heap.empty_chunks--;
     }
-    return p;
+
+    // split off upper halves until the block has the requested size
+    while (found_order > order)
+    {
+        found_order--;
+        free_list_push(buddy_of(node, found_order), found_order);
+    }
+
+    return node;
 }
 
-size_t buddy_node_size_required(size_t size)
+static void *buddy_alloc(size_t size)
 {
-    size_t actual_size = alignment;
-
-    size += sizeof(buddy_node_t);
-    size = align_forward_size(size, alignment);
+    uint8_t order = order_for_size(size);
+    if (order > heap.max_order)
+    {
+        return NULL;
+    }
 
-    while (size > actual_size)
+    buddy_node_t *node = take_free_block(order);
+    if (!node)
     {
-        actual_size <<= 1;
+        if (grow_heap(order) < 0)
+        {
+            return NULL; // out of memory
+        }
+
+        node = take_free_block(order);
     }
 
-    return actual_size;
+    node->order = order;
+    node->free = false;
+
+    heap.stats.used += block_size(order);
+    update_peak_stats();
+
+    return (void *)((uintptr_t)node + heap.alignment);
 }
 
-void buddy_node_coalescence(buddy_node_t *head, buddy_node_t *tail)
+static void buddy_free(void *ptr)
 {
-    for (;;)
+    buddy_node_t *node = (buddy_node_t *)((uintptr_t)ptr - heap.alignment);
+    if (node->free)
     {
-        // Keep looping until there are no more buddies to coalesce
+        return; // double free
+    }
 
-        buddy_node_t *block = head;
-        buddy_node_t *buddy = buddy_node_next(block);
+    size_t slot = slot_of(node);
+    uint8_t chunk_order = heap.chunks[slot].order;
+    uint8_t order = node->order;
+    heap.stats.used -= block_size(order);
 
-        bool no_coalescence = true;
-        while (block < tail && buddy < tail)
-        { // make sure the buddies are within the range
-            if (block->free && buddy->free && block->size == buddy->size)
-            {
-                // Coalesce buddies into one
-                block->size <<= 1;
-                block = buddy_node_next(block);
-                if (block < tail)
-                {
-                    buddy = buddy_node_next(block);
-                    no_coalescence = false;
-                }
-            }
-            else if (block->size < buddy->size)
-            {
-                // The buddy block is split into smaller blocks
-                block = buddy;
-                buddy = buddy_node_next(buddy);
-            }
-            else
-            {
-                block = buddy_node_next(buddy);
-                if (block < tail)
-                {
-                    // Leave the buddy block for the next iteration
-                    buddy = buddy_node_next(block);
-                }
-            }
+    while (order < chunk_order)
+    {
+        buddy_node_t *buddy = buddy_of(node, order);
+        if (!buddy->free || buddy->order != order)
+        {
+            break;
         }
 
-        if (no_coalescence)
+        free_list_remove(buddy);
+        if (buddy < node)
         {
-            return;
+            node = buddy;
         }
+        order++;
     }
+
+    free_list_push(node, order);
+
+    if (order == chunk_order)
+    {
+        heap.empty_chunks++;
+        if (heap.empty_chunks > KMM_MAX_EMPTY_CHUNKS)
+        {
+            release_chunk(slot);
+        }
+    }
+}
+
+
+static uint8_t size_class_of(size_t size)
+{
+    return small.class_of[(size + KMM_SMALL_ALIGN - 1) / KMM_SMALL_ALIGN];
+}
+
+static size_t run_capacity(uint8_t size_class)
+{
+    return (KMM_RUN_SIZE - KMM_RUN_HEADER_SIZE) / size_classes[size_class];
 }
 
-void *buddy_allocator_alloc(size_t size)
+static void run_list_push(size_class_t *sc, run_t *run)
 {
-    if (size != 0)
+    run->prev = NULL;
+    run->next = sc->partial;
+    if (sc->partial)
     {
-        size_t actual_size = buddy_node_size_required(size);
+        sc->partial->prev = run;
+    }
+    sc->partial = run;
+}
 
-        buddy_node_t *found = buddy_node_find_best(head, tail, actual_size);
-        if (!found)
+static void run_list_remove(size_class_t *sc, run_t *run)
+{
+    if (run->prev)
+    {
+        run->prev->next = run->next;
+    }
+    else
+    {
+        sc->partial = run->next;
+    }
+
+    if (run->next)
+    {
+        run->next->prev = run->prev;
+    }
+}
+
+static run_t *run_create(uint8_t size_class)
+{
+    run_t *run = pmm_alloc_pages(KMM_RUN_ORDER);
+    if (!run)
+    {
+        return NULL;
+    }
+
+    size_t capacity = run_capacity(size_class);
+    memset(run, 0, sizeof(run_t));
+    run->magic = KMM_RUN_MAGIC;
+    run->size_class = size_class;
+    run->num_free = capacity;
+    for (size_t i = 0; i < capacity; i++)
+    {
+        run->free[i / 64] |= 1UL << (i % 64);
+    }
+
+    for (size_t i = 0; i < KMM_RUN_BITMAP_WORDS; i++)
+    {
+        if (run->free[i])
         {
-            // Try to coalesce all the free buddy blocks and then search again
-            buddy_node_coalescence(head, tail);
-            found = buddy_node_find_best(head, tail, actual_size);
+            run->summary |= 1 << i;
         }
+    }
+
+    small.classes[size_class].empty_runs++;
+    heap.stats.runs++;
+    heap.stats.mapped += KMM_RUN_SIZE;
+    update_peak_stats();
+
+    return run;
+}
+
+// the run has to be empty and on its partial list
+static size_t run_release(run_t *run)
+{
+    size_class_t *sc = &small.classes[run->size_class];
+    run_list_remove(sc, run);
+    sc->empty_runs--;
+
+    heap.stats.runs--;
+    heap.stats.mapped -= KMM_RUN_SIZE;
+
+    run->magic = 0;
+    pmm_free_pages(run, KMM_RUN_ORDER);
+    return 1UL << KMM_RUN_ORDER;
+}
+
+static void *small_alloc(size_t size)
+{
+    uint8_t size_class = size_class_of(size);
+    size_class_t *sc = &small.classes[size_class];
+
+    run_t *run = sc->partial;
+    if (!run)
+    {
+        run = run_create(size_class);
+        if (!run)
+        {
+            return NULL;
+        }
+        run_list_push(sc, run);
+    }
+
+    if (run->num_free == run_capacity(size_class))
+    {
+        sc->empty_runs--;
+    }
+
+    // the summary points at a word with a free slot, so there is nothing to scan
+    size_t word = __builtin_ctz(run->summary);
+    size_t index = word * 64 + __builtin_ctzl(run->free[word]);
+    run->free[word] &= ~(1UL << (index % 64));
+    if (run->free[word] == 0)
+    {
+        run->summary &= ~(1 << word);
+    }
+
+    run->num_free--;
+    if (run->num_free == 0)
+    {
+        run_list_remove(sc, run); // full runs aren't tracked until something in them is freed
+    }
+
+    heap.stats.used += size_classes[size_class];
+    update_peak_stats();
+
+    return (uint8_t *)run + KMM_RUN_HEADER_SIZE + index * size_classes[size_class];
+}
+
+// finds the run of a pointer outside the heap range, anything else that gets here is a bug of the caller
+static run_t *run_of(void *ptr)
+{
+    run_t *run = (run_t *)((uintptr_t)ptr & ~(uintptr_t)(KMM_RUN_SIZE - 1));
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)run;
+
+    // runs are identity mapped pmm pages, so only look at the header once the pmm knows the page
+    if ((uintptr_t)run + KMM_RUN_SIZE > get_max_addr() || pmm_get_refs(run) == 0 || run->magic != KMM_RUN_MAGIC ||
+        run->size_class >= KMM_NUM_SIZE_CLASSES || offset < KMM_RUN_HEADER_SIZE || (offset - KMM_RUN_HEADER_SIZE) % size_classes[run->size_class] != 0)
+    {
+        KPANIC("kfree of a pointer that is not from kmalloc: %p\n", ptr);
+    }
 
-        if (found != NULL)
+    return run;
+}
+
+static void small_free(void *ptr)
+{
+    run_t *run = run_of(ptr);
+    size_class_t *sc = &small.classes[run->size_class];
+    size_t index = ((uintptr_t)ptr - (uintptr_t)run - KMM_RUN_HEADER_SIZE) / size_classes[run->size_class];
+
+    if (run->free[index / 64] & (1UL << (index % 64)))
+    {
+        return; // double free
+    }
+
+    if (run->num_free == 0)
+    {
+        run_list_push(sc, run);
+    }
+
+    run->free[index / 64] |= 1UL << (index % 64);
+    run->summary |= 1 << (index / 64);
+    run->num_free++;
+
+    heap.stats.used -= size_classes[run->size_class];
+
+    if (run->num_free == run_capacity(run->size_class))
+    {
+        sc->empty_runs++;
+        if (sc->empty_runs > KMM_MAX_EMPTY_RUNS)
         {
-            found->free = false;
-            return (void *)((char *)found + alignment);
+            run_release(run);
         }
+    }
+}
+
+static void *heap_alloc(size_t size)
+{
+    if (size == 0 || size > KMM_CHUNK_MAX_SIZE || !heap.pml4)
+    {
+        return NULL;
+    }
+
+    if (size <= KMM_SMALL_MAX && heap.alignment <= KMM_SMALL_ALIGN)
+    {
+        return small_alloc(size);
+    }
 
-        // Out of memory (possibly due to too much internal fragmentation)
+    return buddy_alloc(size);
+}
+
+static void heap_free(void *ptr)
+{
+    if (!ptr)
+    {
+        return;
     }
 
-    return NULL;
+    // runs come straight from the pmm, only buddy blocks live in the heap range
+    if (in_heap_range(ptr))
+    {
+        buddy_free(ptr);
+    }
+    else
+    {
+        small_free(ptr);
+    }
 }
 
 void *kmalloc(size_t size)
 {
-    return buddy_allocator_alloc(size);
+    void *res = heap_alloc(size);
+    PROFILE_ALLOC(res, size);
+    return res;
 }
 
 void kfree(void *ptr)
+{
+    PROFILE_FREE(ptr);
+    heap_free(ptr);
+}
+
+size_t kmm_shrink(void)
+{
+    size_t res = 0;
+    for (size_t slot = 0; slot < KMM_NUM_SLOTS && heap.empty_chunks > 0; slot++)
+    {
+        buddy_node_t *node = slot_base(slot);
+        if (heap.chunks[slot].used && node->free && node->order == heap.chunks[slot].order)
+        {
+            res += release_chunk(slot);
+        }
+    }
+
+    for (uint8_t i = 0; i < KMM_NUM_SIZE_CLASSES; i++)
+    {
+        size_class_t *sc = &small.classes[i];
+        run_t *run = sc->partial;
+        while (run && sc->empty_runs > 0)
+        {
+            run_t *next = run->next;
+            if (run->num_free == run_capacity(i))
+            {
+                res += run_release(run);
+            }
+            run = next;
+        }
+    }
+
+    return res;
+}
+
+size_t ksize(void *ptr)
 {
     if (!ptr)
     {
-        return;
+        return 0;
+    }
+
+    if (in_heap_range(ptr))
+    {
+        buddy_node_t *node = (buddy_node_t *)((uintptr_t)ptr - heap.alignment);
+        return block_size(node->order) - heap.alignment;
     }
 
-    buddy_node_t *node;
+    return size_classes[run_of(ptr)->size_class];
+}
 
-    node = (buddy_node_t *)((char *)ptr - alignment);
-    node->free = true;
+// resizes a buddy block without moving it, by splitting it or by absorbing free upper buddies
+static bool buddy_resize(void *ptr, size_t new_size)
+{
+    buddy_node_t *node = (buddy_node_t *)((uintptr_t)ptr - heap.alignment);
+    uint8_t chunk_order = heap.chunks[slot_of(node)].order;
+    uint8_t old_order = node->order;
+    uint8_t new_order = order_for_size(new_size);
+    if (new_order > chunk_order)
+    {
+        return false;
+    }
+
+    // only upper buddies can be absorbed, so check the whole way up before changing anything
+    for (uint8_t order = old_order; order < new_order; order++)
+    {
+        buddy_node_t *buddy = buddy_of(node, order);
+        if (buddy < node || !buddy->free || buddy->order != order)
+        {
+            return false;
+        }
+    }
+
+    for (uint8_t order = old_order; order < new_order; order++)
+    {
+        free_list_remove(buddy_of(node, order));
+    }
+
+    // the upper halves given back can't merge, their buddy is still part of this block
+    for (uint8_t order = old_order; order > new_order; order--)
+    {
+        free_list_push(buddy_of(node, order - 1), order - 1);
+    }
+
+    node->order = new_order;
+    heap.stats.used = heap.stats.used - block_size(old_order) + block_size(new_order);
+    update_peak_stats();
 
-    buddy_node_coalescence(head, tail);
+    return true;
 }
 
-void *krealloc(void *ptr, size_t old_size, size_t new_size)
+void *krealloc(void *ptr, size_t new_size)
 {
-    void *res = kmalloc(new_size);
-    memcpy(res, ptr, old_size);
-    kfree(ptr);
+    if (!ptr)
+    {
+        void *res = heap_alloc(new_size);
+        PROFILE_ALLOC(res, new_size);
+        return res;
+    }
+
+    if (new_size == 0)
+    {
+        PROFILE_FREE(ptr);
+        heap_free(ptr);
+        return NULL;
+    }
+
+    size_t old_size = ksize(ptr);
+    bool small_size = new_size <= KMM_SMALL_MAX && heap.alignment <= KMM_SMALL_ALIGN;
+    bool in_place = false;
+    if (in_heap_range(ptr))
+    {
+        in_place = !small_size && buddy_resize(ptr, new_size);
+    }
+    else
+    {
+        in_place = new_size <= old_size && size_class_of(new_size) == size_class_of(old_size);
+    }
+
+    if (in_place)
+    {
+        PROFILE_FREE(ptr);
+        PROFILE_ALLOC(ptr, new_size);
+        return ptr;
+    }
+
+    void *res = heap_alloc(new_size);
+    if (!res)
+    {
+        return NULL;
+    }
+
+    memcpy(res, ptr, old_size < new_size ? old_size : new_size);
+    PROFILE_FREE(ptr);
+    heap_free(ptr);
+    PROFILE_ALLOC(res, new_size);
     return res;
 }
+
+void kmm_get_stats(kmm_stats_t *stats)
+{
+    if (!stats)
+    {
+        return;
+    }
+
+    *stats = heap.stats;
+}
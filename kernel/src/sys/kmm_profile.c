@@ -0,0 +1,255 @@
+#ifdef KMM_PROFILE
+
+#include <kernel/kmm.h>
+#include <kernel/kprintf.h>
+#include <kernel/port.h>
+#include <kernel/pit.h>
+#include <kernel/string.h>
+
+#define EMPTY_SLOT 0
+#define NO_CALL_SITE UINT16_MAX
+
+// live allocations, open addressing with linear probing keyed by the pointer
+typedef struct
+{
+    uintptr_t ptr;
+    uint32_t size;
+    uint16_t call_site;
+    uint64_t tick;
+} live_alloc_t;
+
+static live_alloc_t live_allocs[KMM_PROFILE_MAX_ALLOCS];
+static kmm_call_site_t call_sites[KMM_PROFILE_MAX_CALL_SITES];
+
+static struct
+{
+    size_t live_allocs;
+    size_t live_bytes;
+    uint64_t total_allocs;
+    uint64_t total_frees;
+    uint64_t dropped;
+} profile;
+
+static size_t hash_ptr(uintptr_t ptr, size_t capacity)
+{
+    return (size_t)((ptr >> 4) * 0x9E3779B97F4A7C15UL) & (capacity - 1);
+}
+
+static uint16_t find_call_site(void *caller)
+{
+    size_t i = hash_ptr((uintptr_t)caller, KMM_PROFILE_MAX_CALL_SITES);
+    for (size_t probes = 0; probes < KMM_PROFILE_MAX_CALL_SITES; probes++)
+    {
+        if (call_sites[i].caller == caller)
+        {
+            return (uint16_t)i;
+        }
+
+        if (!call_sites[i].caller)
+        {
+            call_sites[i].caller = caller;
+            return (uint16_t)i;
+        }
+
+        i = (i + 1) & (KMM_PROFILE_MAX_CALL_SITES - 1);
+    }
+
+    return NO_CALL_SITE;
+}
+
+static live_alloc_t *find_live_alloc(uintptr_t ptr)
+{
+    size_t i = hash_ptr(ptr, KMM_PROFILE_MAX_ALLOCS);
+    while (live_allocs[i].ptr != EMPTY_SLOT)
+    {
+        if (live_allocs[i].ptr == ptr)
+        {
+            return &live_allocs[i];
+        }
+        i = (i + 1) & (KMM_PROFILE_MAX_ALLOCS - 1);
+    }
+
+    return NULL;
+}
+
+void kmm_profile_alloc(void *ptr, size_t size, void *caller)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    profile.total_allocs++;
+
+    // keep one slot free so probing always ends
+    uint16_t site = find_call_site(caller);
+    if (site == NO_CALL_SITE || profile.live_allocs >= KMM_PROFILE_MAX_ALLOCS - 1)
+    {
+        profile.dropped++;
+        return;
+    }
+
+    size_t i = hash_ptr((uintptr_t)ptr, KMM_PROFILE_MAX_ALLOCS);
+    while (live_allocs[i].ptr != EMPTY_SLOT)
+    {
+        i = (i + 1) & (KMM_PROFILE_MAX_ALLOCS - 1);
+    }
+
+    live_allocs[i].ptr = (uintptr_t)ptr;
+    live_allocs[i].size = (uint32_t)size;
+    live_allocs[i].call_site = site;
+    live_allocs[i].tick = pit_get_ticks();
+
+    call_sites[site].live_bytes += size;
+    call_sites[site].live_allocs++;
+    call_sites[site].total_allocs++;
+    call_sites[site].total_bytes += size;
+
+    profile.live_allocs++;
+    profile.live_bytes += size;
+}
+
+void kmm_profile_free(void *ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    profile.total_frees++;
+
+    live_alloc_t *entry = find_live_alloc((uintptr_t)ptr);
+    if (!entry)
+    {
+        return; // dropped when it was allocated
+    }
+
+    kmm_call_site_t *site = &call_sites[entry->call_site];
+    site->live_bytes -= entry->size;
+    site->live_allocs--;
+    profile.live_allocs--;
+    profile.live_bytes -= entry->size;
+
+    // backward shift deletion, move later entries of the probe chain into the hole
+    size_t hole = entry - live_allocs;
+    size_t i = hole;
+    for (;;)
+    {
+        i = (i + 1) & (KMM_PROFILE_MAX_ALLOCS - 1);
+        if (live_allocs[i].ptr == EMPTY_SLOT)
+        {
+            break;
+        }
+
+        size_t home = hash_ptr(live_allocs[i].ptr, KMM_PROFILE_MAX_ALLOCS);
+        if (((i - home) & (KMM_PROFILE_MAX_ALLOCS - 1)) >= ((i - hole) & (KMM_PROFILE_MAX_ALLOCS - 1)))
+        {
+            live_allocs[hole] = live_allocs[i];
+            hole = i;
+        }
+    }
+
+    live_allocs[hole].ptr = EMPTY_SLOT;
+}
+
+void kmm_profile_get_stats(kmm_profile_stats_t *stats)
+{
+    if (!stats)
+    {
+        return;
+    }
+
+    kmm_stats_t heap_stats;
+    kmm_get_stats(&heap_stats);
+
+    memset(stats, 0, sizeof(kmm_profile_stats_t));
+    stats->live_allocs = profile.live_allocs;
+    stats->live_bytes = profile.live_bytes;
+    stats->total_allocs = profile.total_allocs;
+    stats->total_frees = profile.total_frees;
+    stats->dropped = profile.dropped;
+
+    uint64_t ticks = pit_get_ticks();
+    if (ticks > 0)
+    {
+        stats->allocs_per_second = profile.total_allocs * pit_get_frequency() / ticks;
+    }
+
+    if (heap_stats.used > profile.live_bytes)
+    {
+        stats->internal_waste = heap_stats.used - profile.live_bytes;
+    }
+
+    if (heap_stats.mapped > 0)
+    {
+        stats->fragmentation = (heap_stats.mapped - heap_stats.used) * 100 / heap_stats.mapped;
+    }
+}
+
+size_t kmm_profile_get_call_sites(kmm_call_site_t *sites, size_t max_sites)
+{
+    size_t res = 0;
+    for (size_t i = 0; i < KMM_PROFILE_MAX_CALL_SITES && res < max_sites; i++)
+    {
+        if (call_sites[i].caller)
+        {
+            sites[res++] = call_sites[i];
+        }
+    }
+
+    return res;
+}
+
+static void e9_print(const char *format, ...)
+{
+    char buffer[128];
+
+    va_list va;
+    va_start(va, format);
+    vsnprintf(buffer, sizeof(buffer), format, va);
+    va_end(va);
+
+    for (char *c = buffer; *c; c++)
+    {
+        port_byte_out(0xE9, *c);
+    }
+}
+
+void kmm_profile_report(uint64_t min_age_ms)
+{
+    uint64_t now = pit_get_ticks();
+    uint32_t frequency = pit_get_frequency();
+
+    e9_print("kmm: live allocations older than %lu ms\n", min_age_ms);
+    for (size_t i = 0; i < KMM_PROFILE_MAX_ALLOCS; i++)
+    {
+        live_alloc_t *entry = &live_allocs[i];
+        if (entry->ptr == EMPTY_SLOT)
+        {
+            continue;
+        }
+
+        uint64_t age_ms = frequency ? (now - entry->tick) * 1000 / frequency : 0;
+        if (age_ms >= min_age_ms)
+        {
+            e9_print("  %p %u bytes from %p, %lu ms old\n", (void *)entry->ptr, entry->size, call_sites[entry->call_site].caller, age_ms);
+        }
+    }
+
+    e9_print("kmm: call sites\n");
+    for (size_t i = 0; i < KMM_PROFILE_MAX_CALL_SITES; i++)
+    {
+        kmm_call_site_t *site = &call_sites[i];
+        if (site->caller && site->live_allocs > 0)
+        {
+            e9_print("  %p: %lu bytes in %lu allocations, %lu allocations total\n", site->caller, site->live_bytes, site->live_allocs, site->total_allocs);
+        }
+    }
+
+    kmm_profile_stats_t stats;
+    kmm_profile_get_stats(&stats);
+    e9_print("kmm: %lu live bytes, %lu allocs/s, %lu bytes rounding waste, %lu%% fragmentation, %lu dropped\n",
+             stats.live_bytes, stats.allocs_per_second, stats.internal_waste, stats.fragmentation, stats.dropped);
+}
+
+#endif
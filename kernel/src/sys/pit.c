@@ -8,6 +8,7 @@ uint8_t num_pit_handlers = 0;
 
 static uint32_t _frequency;
 static uint64_t sleep_ticks = 0;
+static uint64_t ticks = 0;
 
 static void timer_irq(interrupt_frame_t *frame)
 {
@@ -17,6 +18,7 @@ static void timer_irq(interrupt_frame_t *frame)
     }
 
     sleep_ticks++;
+    ticks++;
 }
 
 int pit_init(uint32_t frequency)
@@ -43,6 +45,11 @@ uint32_t pit_get_frequency(void)
     return _frequency;
 }
 
+uint64_t pit_get_ticks(void)
+{
+    return ticks;
+}
+
 void register_pit_handler(void (*func)(interrupt_frame_t *frame, uint32_t frequency))
 {
     pit_handlers[num_pit_handlers++] = func;
@@ -1,34 +1,495 @@
 #include <kernel/pmm.h>
 #include <kernel/string.h>
+#include <kernel/cpu.h>
+#include <kernel/pit.h>
 #include <stdbool.h>
 
+extern int __kernel_start;
+extern int __kernel_end;
+
+#define BITMAP_LEVELS 3
+
+// bootstrap.asm identity maps the first GiB, nothing above it is reachable before kmain builds its page tables
+#define BOOT_MAPPED_LIMIT 0x40000000
+
+// physical memory is managed in 16 MiB sections, metadata only exists for sections that contain ram
+#define SECTION_PAGES 4096
+#define SECTION_INVALID UINT32_MAX
+#define SECTION_REFS_WORDS (SECTION_PAGES * sizeof(uint16_t) / sizeof(uint64_t))
+
+// refs value of a free page held in a magazine or the zero pool, catches double frees without touching the buddy maps
+#define PAGE_REFS_CACHED UINT16_MAX
+
+#define MAX_RECLAIMABLE_RANGES 8
+
+/*
+ level 0 has one bit per entry, set if the entry is free.
+ a bit in level n + 1 is set if the corresponding word in level n has any bit set,
+ so finding a free entry only touches one word per level.
+*/
+typedef struct
+{
+    uint64_t *levels[BITMAP_LEVELS];
+    uint64_t num_words[BITMAP_LEVELS];
+} free_bitmap_t;
+
+/*
+ every section is a small buddy allocator. for every order its free map is one summary word
+ followed by one bit per block of 2^order pages, set if the block is free.
+*/
+typedef struct
+{
+    uint64_t start_page;
+    uint64_t *free_maps;
+    uint16_t *refs; // references beyond the first, for pages shared between address spaces, or PAGE_REFS_CACHED
+} section_t;
+
+// a zone keeps one bit per section and order, set if the section has a free block of exactly that order
+typedef struct
+{
+    free_bitmap_t section_maps[PMM_MAX_ORDER + 1];
+    section_t *sections; // sorted by address
+    uint64_t num_sections;
+    uint64_t mapped_sections; // sections reachable through the current page tables
+    uint64_t free_pages;
+} zone_t;
+
+static const uint64_t zone_limits[PMM_NUM_ZONES] = {
+    [PMM_ZONE_DMA16] = 0x1000000 / PAGE_SIZE,
+    [PMM_ZONE_DMA32] = 0x100000000 / PAGE_SIZE,
+    [PMM_ZONE_NORMAL] = UINT64_MAX,
+};
+
+typedef struct
+{
+    uint64_t start_page;
+    uint64_t end_page;
+} page_range_t;
+
 struct
 {
-    uint64_t *bitmap;
+    zone_t zones[PMM_NUM_ZONES];
+    section_t *sections;
+    uint64_t num_sections;
+    uint32_t *section_index; // indexed by page / SECTION_PAGES, SECTION_INVALID for holes
+    uint64_t num_section_slots;
     uint64_t num_pages;
-    uint64_t last_index;
+    uint64_t free_pages;
     uint64_t max_addr;
+    uint64_t mapped_pages; // pages below this are reachable through the current page tables
+    page_range_t reclaimable[MAX_RECLAIMABLE_RANGES];
+    size_t num_reclaimable;
 } page_allocator;
 
-static void bit_set(uint64_t *bitmap, uint64_t index)
+static uint64_t section_map_offsets[PMM_MAX_ORDER + 2];
+
+// per cpu and zone cache of single pages, so the common pmm_alloc/pmm_free path is a pointer pop/push
+typedef struct
 {
-    uint64_t array_index = index / 64;
-    uint64_t bit_offset = index % 64;
-    bitmap[array_index] |= (1UL << bit_offset);
+    void *pages[PMM_MAGAZINE_SIZE];
+    size_t count;
+} page_magazine_t;
+
+static page_magazine_t magazines[MAX_CPUS][PMM_NUM_ZONES];
+static size_t magazine_batch = PMM_MAGAZINE_BATCH;
+
+// pages zeroed ahead of time, refilled while user code runs
+struct
+{
+    void *pages[PMM_ZERO_POOL_SIZE];
+    size_t count;
+    uint64_t hits;
+    uint64_t misses;
+} zero_pool;
+
+static uint64_t free_bitmap_words(uint64_t num_bits, uint64_t num_words[BITMAP_LEVELS])
+{
+    uint64_t total = 0;
+    for (int level = 0; level < BITMAP_LEVELS; level++)
+    {
+        num_bits = (num_bits + 64 - 1) / 64;
+        num_words[level] = num_bits;
+        total += num_bits;
+    }
+
+    return total;
 }
 
-static void bit_clear(uint64_t *bitmap, uint64_t index)
+static void free_bitmap_init(free_bitmap_t *map, uint64_t *storage, uint64_t num_bits)
 {
-    uint64_t array_index = index / 64;
-    uint64_t bit_offset = index % 64;
-    bitmap[array_index] &= ~(1UL << bit_offset);
+    free_bitmap_words(num_bits, map->num_words);
+    for (int level = 0; level < BITMAP_LEVELS; level++)
+    {
+        map->levels[level] = storage;
+        memset(storage, 0, map->num_words[level] * sizeof(uint64_t));
+        storage += map->num_words[level];
+    }
 }
 
-static bool bit_get(const uint64_t *bitmap, uint64_t index)
+static void free_bitmap_set(free_bitmap_t *map, uint64_t index)
 {
-    uint64_t array_index = index / 64;
-    uint64_t bit_offset = index % 64;
-    return (bitmap[array_index] & (1UL << bit_offset)) != 0;
+    for (int level = 0; level < BITMAP_LEVELS; level++)
+    {
+        uint64_t *word = &map->levels[level][index / 64];
+        bool was_empty = *word == 0;
+        *word |= (1UL << (index % 64));
+        if (!was_empty)
+        {
+            break;
+        }
+        index /= 64;
+    }
+}
+
+static void free_bitmap_clear(free_bitmap_t *map, uint64_t index)
+{
+    for (int level = 0; level < BITMAP_LEVELS; level++)
+    {
+        uint64_t *word = &map->levels[level][index / 64];
+        *word &= ~(1UL << (index % 64));
+        if (*word != 0)
+        {
+            break;
+        }
+        index /= 64;
+    }
+}
+
+// returns the highest set bit below end, false if there is none
+static bool free_bitmap_find_last(const free_bitmap_t *map, uint64_t end, uint64_t *index)
+{
+    const int top = BITMAP_LEVELS - 1;
+
+    int level = 0;
+    uint64_t i = 0;
+    bool found = false;
+    for (; level <= top && end > 0 && !found; level++)
+    {
+        uint64_t word = (end - 1) / 64;
+        uint64_t bit = (end - 1) % 64;
+        uint64_t mask = bit == 63 ? UINT64_MAX : (2UL << bit) - 1;
+        if (map->levels[level][word] & mask)
+        {
+            i = word * 64 + 63 - __builtin_clzl(map->levels[level][word] & mask);
+            found = true;
+            break;
+        }
+
+        if (level == top)
+        {
+            // nothing above the top level, scan the remaining words
+            while (word-- > 0)
+            {
+                if (map->levels[level][word] != 0)
+                {
+                    i = word * 64 + 63 - __builtin_clzl(map->levels[level][word]);
+                    found = true;
+                    break;
+                }
+            }
+            break;
+        }
+
+        // everything below word in this level is summarized by the bits below word in the next one
+        end = word;
+    }
+
+    if (!found)
+    {
+        return false;
+    }
+
+    // the bit index at one level is the word index at the level below
+    while (level-- > 0)
+    {
+        i = i * 64 + 63 - __builtin_clzl(map->levels[level][i]);
+    }
+
+    *index = i;
+    return true;
+}
+
+static void section_map_set(uint64_t *map, uint64_t index)
+{
+    map[1 + index / 64] |= (1UL << (index % 64));
+    map[0] |= (1UL << (index / 64));
+}
+
+// returns true if the map is empty afterwards
+static bool section_map_clear(uint64_t *map, uint64_t index)
+{
+    uint64_t *word = &map[1 + index / 64];
+    *word &= ~(1UL << (index % 64));
+    if (*word == 0)
+    {
+        map[0] &= ~(1UL << (index / 64));
+    }
+
+    return map[0] == 0;
+}
+
+static bool section_map_get(const uint64_t *map, uint64_t index)
+{
+    return (map[1 + index / 64] & (1UL << (index % 64))) != 0;
+}
+
+// the map must not be empty
+static uint64_t section_map_find_last(const uint64_t *map)
+{
+    uint64_t word = 63 - __builtin_clzl(map[0]);
+    return word * 64 + 63 - __builtin_clzl(map[1 + word]);
+}
+
+static uint64_t *section_free_map(const section_t *section, uint8_t order)
+{
+    return section->free_maps + section_map_offsets[order];
+}
+
+static pmm_zone_t zone_of_page(uint64_t page)
+{
+    for (pmm_zone_t zone = PMM_ZONE_DMA16; zone < PMM_NUM_ZONES; zone++)
+    {
+        if (page < zone_limits[zone])
+        {
+            return zone;
+        }
+    }
+
+    return PMM_ZONE_NORMAL;
+}
+
+static section_t *section_of_page(uint64_t page)
+{
+    uint64_t slot = page / SECTION_PAGES;
+    if (slot >= page_allocator.num_section_slots || page_allocator.section_index[slot] == SECTION_INVALID)
+    {
+        return NULL;
+    }
+
+    return &page_allocator.sections[page_allocator.section_index[slot]];
+}
+
+static uint16_t *page_refs(uint64_t page)
+{
+    section_t *section = section_of_page(page);
+    if (!section)
+    {
+        return NULL;
+    }
+
+    return &section->refs[page - section->start_page];
+}
+
+static void set_cached(void *page, bool cached)
+{
+    uint16_t *refs = page_refs((uint64_t)page / PAGE_SIZE);
+    if (refs)
+    {
+        *refs = cached ? PAGE_REFS_CACHED : 0;
+    }
+}
+
+static void block_set(zone_t *zone, section_t *section, uint64_t index, uint8_t order)
+{
+    uint64_t *map = section_free_map(section, order);
+    if (map[0] == 0)
+    {
+        free_bitmap_set(&zone->section_maps[order], section - zone->sections);
+    }
+
+    section_map_set(map, index);
+}
+
+static void block_clear(zone_t *zone, section_t *section, uint64_t index, uint8_t order)
+{
+    if (section_map_clear(section_free_map(section, order), index))
+    {
+        free_bitmap_clear(&zone->section_maps[order], section - zone->sections);
+    }
+}
+
+static bool block_is_free(const section_t *section, uint64_t index, uint8_t order)
+{
+    for (; order <= PMM_MAX_ORDER; order++, index >>= 1)
+    {
+        if (section_map_get(section_free_map(section, order), index))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// page must be aligned to the block size and part of a present section
+static void free_block(uint64_t page, uint8_t order)
+{
+    zone_t *zone = &page_allocator.zones[zone_of_page(page)];
+    section_t *section = section_of_page(page);
+    uint64_t index = (page - section->start_page) >> order;
+
+    while (order < PMM_MAX_ORDER)
+    {
+        uint64_t buddy = index ^ 1;
+        if (!section_map_get(section_free_map(section, order), buddy))
+        {
+            break;
+        }
+
+        block_clear(zone, section, buddy, order);
+        index >>= 1;
+        order++;
+    }
+
+    block_set(zone, section, index, order);
+}
+
+// uses the smallest order that fits and the highest free block of that order, so low memory is left to allocations that need it
+static void *alloc_block(zone_t *zone, uint8_t order)
+{
+    uint8_t found_order = order;
+    uint64_t section_num;
+    for (; found_order <= PMM_MAX_ORDER; found_order++)
+    {
+        if (free_bitmap_find_last(&zone->section_maps[found_order], zone->mapped_sections, &section_num))
+        {
+            break;
+        }
+    }
+
+    if (found_order > PMM_MAX_ORDER)
+    {
+        return NULL;
+    }
+
+    section_t *section = &zone->sections[section_num];
+    uint64_t index = section_map_find_last(section_free_map(section, found_order));
+    block_clear(zone, section, index, found_order);
+
+    // split the block, keep the upper half and hand the lower one back
+    while (found_order > order)
+    {
+        found_order--;
+        index <<= 1;
+        block_set(zone, section, index, found_order);
+        index++;
+    }
+
+    zone->free_pages -= 1UL << order;
+    return (void *)((section->start_page + (index << order)) * PAGE_SIZE);
+}
+
+static bool range_overlaps(uint64_t start_page, uint64_t end_page, const page_range_t *reserved, size_t num_reserved)
+{
+    for (size_t i = 0; i < num_reserved; i++)
+    {
+        if (start_page < reserved[i].end_page && end_page > reserved[i].start_page)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// hands the pages in [start_addr, end_addr) to the buddy allocators as the largest possible blocks
+static void free_range(uint64_t start_addr, uint64_t end_addr, const page_range_t *reserved, size_t num_reserved)
+{
+    uint64_t page = (start_addr + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t end_page = end_addr / PAGE_SIZE;
+    if (end_page > page_allocator.num_pages)
+    {
+        end_page = page_allocator.num_pages;
+    }
+
+    while (page < end_page)
+    {
+        if (range_overlaps(page, page + 1, reserved, num_reserved) || !section_of_page(page))
+        {
+            page++;
+            continue;
+        }
+
+        // sections are larger than the biggest block, so aligned blocks never cross them
+        uint8_t order = 0;
+        while (order < PMM_MAX_ORDER)
+        {
+            uint64_t next_size = 2UL << order;
+            if ((page & (next_size - 1)) != 0 || page + next_size > end_page || range_overlaps(page, page + next_size, reserved, num_reserved))
+            {
+                break;
+            }
+            order++;
+        }
+
+        free_block(page, order);
+        page_allocator.zones[zone_of_page(page)].free_pages += 1UL << order;
+        page_allocator.free_pages += 1UL << order;
+        page += 1UL << order;
+    }
+}
+
+static bool section_has_memory(memory_map_entry_t *memory_map, uint64_t num_mmap_entries, uint64_t slot)
+{
+    uint64_t start = slot * SECTION_PAGES * PAGE_SIZE;
+    uint64_t end = start + SECTION_PAGES * PAGE_SIZE;
+
+    for (uint64_t i = 0; i < num_mmap_entries; i++)
+    {
+        if (memory_map[i].type != MMAP_ENTRY_TYPE_AVAILABLE && memory_map[i].type != MMAP_ENTRY_TYPE_ACPI_RECLAIMABLE)
+        {
+            continue;
+        }
+
+        if (memory_map[i].addr < end && memory_map[i].addr + memory_map[i].size > start)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// finds page aligned space for the allocator metadata that doesn't overlap the kernel image and is reachable during boot
+static uint64_t find_metadata_storage(memory_map_entry_t *memory_map, uint64_t num_mmap_entries, uint64_t size)
+{
+    uint64_t kernel_start = (uint64_t)&__kernel_start;
+    uint64_t kernel_end = (uint64_t)&__kernel_end;
+
+    for (uint64_t i = 0; i < num_mmap_entries; i++)
+    {
+        if (memory_map[i].type != MMAP_ENTRY_TYPE_AVAILABLE)
+        {
+            continue;
+        }
+
+        uint64_t start = (memory_map[i].addr + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+        uint64_t end = memory_map[i].addr + memory_map[i].size;
+        if (start < kernel_end && start + size > kernel_start)
+        {
+            start = (kernel_end + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+        }
+
+        if (start + size <= end && start + size <= BOOT_MAPPED_LIMIT)
+        {
+            return start;
+        }
+    }
+
+    return 0;
+}
+
+static void update_mapped_sections(void)
+{
+    for (pmm_zone_t i = PMM_ZONE_DMA16; i < PMM_NUM_ZONES; i++)
+    {
+        zone_t *zone = &page_allocator.zones[i];
+        zone->mapped_sections = 0;
+        while (zone->mapped_sections < zone->num_sections && zone->sections[zone->mapped_sections].start_page < page_allocator.mapped_pages)
+        {
+            zone->mapped_sections++;
+        }
+    }
 }
 
 int pmm_init(memory_map_entry_t *memory_map, uint64_t num_mmap_entries, uint64_t total_memory)
@@ -38,74 +499,492 @@ int pmm_init(memory_map_entry_t *memory_map, uint64_t num_mmap_entries, uint64_t
 
     page_allocator.num_pages = total_memory / PAGE_SIZE;
     page_allocator.max_addr = memory_map[num_mmap_entries - 1].addr + memory_map[num_mmap_entries - 1].size;
-    page_allocator.bitmap = (uint64_t *)page_allocator.max_addr; // needed for validation... nullptr is a possible value here, max_addr isn't
+    page_allocator.mapped_pages = BOOT_MAPPED_LIMIT / PAGE_SIZE;
+    page_allocator.num_section_slots = (page_allocator.num_pages + SECTION_PAGES - 1) / SECTION_PAGES;
 
-    uint64_t bitmap_size = (page_allocator.num_pages + 8 - 1) / 8;
-    for (uint64_t i = 0; i < num_mmap_entries; i++)
+    section_map_offsets[0] = 0;
+    for (uint8_t order = 0; order <= PMM_MAX_ORDER; order++)
     {
-        if (memory_map[i].type != MMAP_ENTRY_TYPE_AVAILABLE)
+        uint64_t blocks = SECTION_PAGES >> order;
+        section_map_offsets[order + 1] = section_map_offsets[order] + 1 + (blocks + 64 - 1) / 64;
+    }
+
+    uint64_t zone_sections[PMM_NUM_ZONES] = {0};
+    for (uint64_t slot = 0; slot < page_allocator.num_section_slots; slot++)
+    {
+        if (section_has_memory(memory_map, num_mmap_entries, slot))
         {
-            continue;
+            zone_sections[zone_of_page(slot * SECTION_PAGES)]++;
+            page_allocator.num_sections++;
         }
+    }
+
+    uint64_t storage_words = (page_allocator.num_section_slots * sizeof(uint32_t) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    storage_words += (page_allocator.num_sections * sizeof(section_t)) / sizeof(uint64_t);
+    storage_words += page_allocator.num_sections * (section_map_offsets[PMM_MAX_ORDER + 1] + SECTION_REFS_WORDS);
+    for (pmm_zone_t i = PMM_ZONE_DMA16; i < PMM_NUM_ZONES; i++)
+    {
+        uint64_t num_words[BITMAP_LEVELS];
+        storage_words += (PMM_MAX_ORDER + 1) * free_bitmap_words(zone_sections[i], num_words);
+    }
+
+    uint64_t storage_size = storage_words * sizeof(uint64_t);
+    uint64_t storage_addr = find_metadata_storage(memory_map, num_mmap_entries, storage_size);
+    if (storage_addr == 0)
+    {
+        res = -1;
+        goto out;
+    }
+
+    uint64_t *storage = (uint64_t *)storage_addr;
+    memset(storage, 0, storage_size); // everything starts out as reserved/used
+
+    page_allocator.section_index = (uint32_t *)storage;
+    storage += (page_allocator.num_section_slots * sizeof(uint32_t) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    page_allocator.sections = (section_t *)storage;
+    storage += (page_allocator.num_sections * sizeof(section_t)) / sizeof(uint64_t);
 
-        if (memory_map[i].size < bitmap_size)
+    uint64_t num_sections = 0;
+    for (uint64_t slot = 0; slot < page_allocator.num_section_slots; slot++)
+    {
+        page_allocator.section_index[slot] = SECTION_INVALID;
+        if (!section_has_memory(memory_map, num_mmap_entries, slot))
         {
             continue;
         }
 
-        page_allocator.bitmap = (uint64_t *)memory_map[i].addr;
-        memory_map[i].addr += bitmap_size;
-        memory_map[i].size -= bitmap_size;
-        break;
+        section_t *section = &page_allocator.sections[num_sections];
+        section->start_page = slot * SECTION_PAGES;
+        section->free_maps = storage;
+        storage += section_map_offsets[PMM_MAX_ORDER + 1];
+        section->refs = (uint16_t *)storage;
+        storage += SECTION_REFS_WORDS;
+
+        zone_t *zone = &page_allocator.zones[zone_of_page(section->start_page)];
+        if (zone->num_sections == 0)
+        {
+            zone->sections = section;
+        }
+        zone->num_sections++;
+
+        page_allocator.section_index[slot] = num_sections++;
     }
 
-    if ((uint64_t)page_allocator.bitmap == page_allocator.max_addr)
+    for (pmm_zone_t i = PMM_ZONE_DMA16; i < PMM_NUM_ZONES; i++)
     {
-        res = -1;
-        goto out;
+        zone_t *zone = &page_allocator.zones[i];
+        for (uint8_t order = 0; order <= PMM_MAX_ORDER; order++)
+        {
+            uint64_t num_words[BITMAP_LEVELS];
+            free_bitmap_init(&zone->section_maps[order], storage, zone->num_sections);
+            storage += free_bitmap_words(zone->num_sections, num_words);
+        }
     }
 
-    memset(page_allocator.bitmap, 0xFF, bitmap_size); // mark everything as reserved/used
+    update_mapped_sections();
+
+    page_range_t reserved[] = {
+        {storage_addr / PAGE_SIZE, (storage_addr + storage_size + PAGE_SIZE - 1) / PAGE_SIZE},
+        {(uint64_t)&__kernel_start / PAGE_SIZE, ((uint64_t)&__kernel_end + PAGE_SIZE - 1) / PAGE_SIZE},
+    };
+
     for (uint64_t i = 0; i < num_mmap_entries; i++)
     {
-        if (memory_map[i].type != MMAP_ENTRY_TYPE_AVAILABLE)
+        if (memory_map[i].type == MMAP_ENTRY_TYPE_ACPI_RECLAIMABLE && page_allocator.num_reclaimable < MAX_RECLAIMABLE_RANGES)
         {
-            continue;
+            page_range_t *range = &page_allocator.reclaimable[page_allocator.num_reclaimable++];
+            // only pages that lie completely inside the range may be reclaimed
+            range->start_page = (memory_map[i].addr + PAGE_SIZE - 1) / PAGE_SIZE;
+            range->end_page = (memory_map[i].addr + memory_map[i].size) / PAGE_SIZE;
         }
 
-        uint64_t start_page = (memory_map[i].addr + PAGE_SIZE - 1) / PAGE_SIZE;
-        for (uint64_t j = 0; j < memory_map[i].size / PAGE_SIZE; j++)
+        if (memory_map[i].type != MMAP_ENTRY_TYPE_AVAILABLE)
         {
-            uint64_t page_index = start_page + j;
-            bit_clear(page_allocator.bitmap, page_index);
+            continue;
         }
+
+        free_range(memory_map[i].addr, memory_map[i].addr + memory_map[i].size, reserved, sizeof(reserved) / sizeof(reserved[0]));
     }
 
 out:
     return res;
 }
 
-void *pmm_alloc(void)
+void pmm_set_mapped_limit(uint64_t addr)
+{
+    page_allocator.mapped_pages = addr / PAGE_SIZE;
+    update_mapped_sections();
+}
+
+void pmm_reclaim_acpi_memory(void)
+{
+    for (size_t i = 0; i < page_allocator.num_reclaimable; i++)
+    {
+        page_range_t *range = &page_allocator.reclaimable[i];
+        free_range(range->start_page * PAGE_SIZE, range->end_page * PAGE_SIZE, NULL, 0);
+    }
+
+    page_allocator.num_reclaimable = 0;
+}
+
+static size_t (*shrinkers[PMM_MAX_SHRINKERS])(void);
+static size_t num_shrinkers = 0;
+static bool shrinking = false;
+
+int pmm_register_shrinker(size_t (*shrink)(void))
+{
+    if (!shrink || num_shrinkers == PMM_MAX_SHRINKERS)
+    {
+        return -EINVARG;
+    }
+
+    shrinkers[num_shrinkers++] = shrink;
+    return 0;
+}
+
+// returns true if any of the shrinkers gave pages back
+static bool run_shrinkers(void)
 {
-    for (uint64_t i = page_allocator.last_index; i < page_allocator.num_pages; i++)
+    // shrinkers free through the pmm and may allocate page tables on the way
+    if (shrinking)
     {
-        if (bit_get(page_allocator.bitmap, i))
+        return false;
+    }
+
+    shrinking = true;
+    size_t freed = 0;
+    for (size_t i = 0; i < num_shrinkers; i++)
+    {
+        freed += shrinkers[i]();
+    }
+    shrinking = false;
+
+    return freed > 0;
+}
+
+// takes the most recently pooled page that lies in zone or below, NULL if there is none
+static void *zero_pool_take(pmm_zone_t zone)
+{
+    for (size_t i = zero_pool.count; i-- > 0;)
+    {
+        void *page = zero_pool.pages[i];
+        if (zone_of_page((uint64_t)page / PAGE_SIZE) > zone)
+        {
             continue;
+        }
+
+        zero_pool.pages[i] = zero_pool.pages[--zero_pool.count];
+        set_cached(page, false);
+        page_allocator.free_pages--;
+        return page;
+    }
+
+    return NULL;
+}
+
+static void magazine_refill(page_magazine_t *magazine, zone_t *zone)
+{
+    while (magazine->count < magazine_batch)
+    {
+        void *page = alloc_block(zone, 0);
+        if (!page)
+        {
+            break;
+        }
+        set_cached(page, true);
+        magazine->pages[magazine->count++] = page;
+    }
+}
+
+static void magazine_drain(page_magazine_t *magazine, zone_t *zone, size_t num)
+{
+    while (num > 0 && magazine->count > 0)
+    {
+        void *page = magazine->pages[--magazine->count];
+        set_cached(page, false);
+        free_block((uint64_t)page / PAGE_SIZE, 0);
+        zone->free_pages++;
+        num--;
+    }
+}
+
+static void drain_all_magazines(void)
+{
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        for (pmm_zone_t zone = PMM_ZONE_DMA16; zone < PMM_NUM_ZONES; zone++)
+        {
+            magazine_drain(&magazines[cpu][zone], &page_allocator.zones[zone], PMM_MAGAZINE_SIZE);
+        }
+    }
+}
+
+void *pmm_alloc_pages_zone(pmm_zone_t zone, uint8_t order)
+{
+    if (order > PMM_MAX_ORDER || zone >= PMM_NUM_ZONES)
+    {
+        return NULL;
+    }
 
-        bit_set(page_allocator.bitmap, i);
-        page_allocator.last_index = i;
+    // fall back to lower zones if the preferred one is exhausted
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        for (int i = zone; i >= PMM_ZONE_DMA16; i--)
+        {
+            void *res = alloc_block(&page_allocator.zones[i], order);
+            if (res)
+            {
+                page_allocator.free_pages -= 1UL << order;
+                return res;
+            }
+        }
+
+        // the last attempt runs after caches outside the pmm gave memory back
+        if (attempt == 1 && !run_shrinkers())
+        {
+            break;
+        }
 
-        return (void *)(i * PAGE_SIZE);
+        // cached single pages may be all that keeps smaller blocks from merging
+        if (order > 0)
+        {
+            drain_all_magazines();
+        }
     }
 
     return NULL;
 }
 
+void *pmm_alloc_pages(uint8_t order)
+{
+    return pmm_alloc_pages_zone(PMM_ZONE_NORMAL, order);
+}
+
+void pmm_free_pages(void *addr, uint8_t order)
+{
+    uint64_t page = (uint64_t)addr / PAGE_SIZE;
+    if (order > PMM_MAX_ORDER || (page & ((1UL << order) - 1)) != 0)
+    {
+        return;
+    }
+
+    section_t *section = section_of_page(page);
+    if (!section || block_is_free(section, (page - section->start_page) >> order, order))
+    {
+        return;
+    }
+
+    free_block(page, order);
+    page_allocator.zones[zone_of_page(page)].free_pages += 1UL << order;
+    page_allocator.free_pages += 1UL << order;
+}
+
+void *pmm_alloc_zone(pmm_zone_t zone)
+{
+    if (zone >= PMM_NUM_ZONES)
+    {
+        return NULL;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        for (int i = zone; i >= PMM_ZONE_DMA16; i--)
+        {
+            page_magazine_t *magazine = &magazines[cpu_get_id()][i];
+            if (magazine->count == 0)
+            {
+                magazine_refill(magazine, &page_allocator.zones[i]);
+            }
+
+            if (magazine->count > 0)
+            {
+                page_allocator.free_pages--;
+                void *page = magazine->pages[--magazine->count];
+                set_cached(page, false);
+                return page;
+            }
+        }
+
+        // the pool is filled from NORMAL, so lower zones can only use the few pages that ended up there
+        void *page = zero_pool_take(zone);
+        if (page)
+        {
+            return page;
+        }
+
+        if (!run_shrinkers())
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+void *pmm_alloc(void)
+{
+    return pmm_alloc_zone(PMM_ZONE_NORMAL);
+}
+
 void pmm_free(uint64_t *page)
 {
     uint64_t index = (uint64_t)page / PAGE_SIZE;
-    bit_clear(page_allocator.bitmap, index);
-    page_allocator.last_index = index;
+    section_t *section = section_of_page(index);
+    if (!section || (uint64_t)page % PAGE_SIZE != 0)
+    {
+        return;
+    }
+
+    uint16_t *refs = &section->refs[index - section->start_page];
+    if (*refs == PAGE_REFS_CACHED || block_is_free(section, index - section->start_page, 0))
+    {
+        return; // double free
+    }
+
+    if (*refs > 0)
+    {
+        (*refs)--; // still mapped somewhere else
+        return;
+    }
+
+    pmm_zone_t zone = zone_of_page(index);
+    page_magazine_t *magazine = &magazines[cpu_get_id()][zone];
+    if (magazine->count == PMM_MAGAZINE_SIZE)
+    {
+        magazine_drain(magazine, &page_allocator.zones[zone], magazine_batch);
+    }
+
+    *refs = PAGE_REFS_CACHED;
+    magazine->pages[magazine->count++] = page;
+    page_allocator.free_pages++;
+}
+
+int pmm_ref(void *page)
+{
+    uint64_t index = (uint64_t)page / PAGE_SIZE;
+    section_t *section = section_of_page(index);
+    if (!section || (uint64_t)page % PAGE_SIZE != 0)
+    {
+        return -EINVARG;
+    }
+
+    uint16_t *refs = &section->refs[index - section->start_page];
+    if (*refs == PAGE_REFS_CACHED)
+    {
+        return -EINVARG; // the page is free
+    }
+
+    if (*refs == PAGE_REFS_CACHED - 1)
+    {
+        return -ENOMEM;
+    }
+
+    (*refs)++;
+    return 0;
+}
+
+uint32_t pmm_get_refs(void *page)
+{
+    uint64_t index = (uint64_t)page / PAGE_SIZE;
+    section_t *section = section_of_page(index);
+    if (!section || section->refs[index - section->start_page] == PAGE_REFS_CACHED)
+    {
+        return 0;
+    }
+
+    return section->refs[index - section->start_page] + 1;
+}
+
+int pmm_set_magazine_batch(size_t batch)
+{
+    if (batch == 0 || batch > PMM_MAGAZINE_SIZE / 2)
+    {
+        return -EINVARG;
+    }
+
+    magazine_batch = batch;
+    return 0;
+}
+
+void *pmm_alloc_zeroed(void)
+{
+    void *page = zero_pool_take(PMM_ZONE_NORMAL);
+    if (page)
+    {
+        zero_pool.hits++;
+        return page;
+    }
+
+    zero_pool.misses++;
+    page = pmm_alloc();
+    if (page)
+    {
+        memset(page, 0, PAGE_SIZE);
+    }
+
+    return page;
+}
+
+void pmm_refill_zero_pool(size_t budget)
+{
+    while (budget > 0 && zero_pool.count < PMM_ZERO_POOL_SIZE)
+    {
+        void *page = pmm_alloc();
+        if (!page)
+        {
+            break;
+        }
+
+        memset(page, 0, PAGE_SIZE);
+        set_cached(page, true);
+        zero_pool.pages[zero_pool.count++] = page;
+        page_allocator.free_pages++; // pooled pages are still free memory
+        budget--;
+    }
+}
+
+static void zero_pool_tick(interrupt_frame_t *frame, uint32_t)
+{
+    // only refill when user code was interrupted, so the allocator is never reentered
+    if ((frame->cs & 3) != 3)
+    {
+        return;
+    }
+
+    pmm_refill_zero_pool(PMM_ZERO_POOL_REFILL_BUDGET);
+}
+
+void pmm_zero_pool_init(void)
+{
+    register_pit_handler(&zero_pool_tick);
+}
+
+void pmm_get_zero_pool_stats(pmm_zero_pool_stats_t *stats)
+{
+    stats->pooled = zero_pool.count;
+    stats->hits = zero_pool.hits;
+    stats->misses = zero_pool.misses;
+}
+
+uint64_t pmm_get_free_pages(void)
+{
+    return page_allocator.free_pages;
+}
+
+uint64_t pmm_get_zone_free_pages(pmm_zone_t zone)
+{
+    if (zone >= PMM_NUM_ZONES)
+    {
+        return 0;
+    }
+
+    uint64_t res = page_allocator.zones[zone].free_pages;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        res += magazines[cpu][zone].count;
+    }
+
+    return res;
 }
 
 uint64_t get_max_addr(void)
@@ -0,0 +1,344 @@
+#include <kernel/slab.h>
+#include <kernel/kmm.h>
+#include <kernel/pmm.h>
+#include <kernel/string.h>
+#include <stdbool.h>
+
+#define SLAB_MIN_ALIGN 8
+#define SLAB_PREFERRED_MAX_ORDER 3
+#define SLAB_MAX_OBJECTS UINT16_MAX
+
+/*
+ a slab is a naturally aligned block of 2^order pages from the pmm:
+ [slab_t][free index stack][color][objects]
+ the stack holds indices instead of pointers inside the objects, so free objects keep their constructed state.
+*/
+typedef struct slab
+{
+    struct slab *prev;
+    struct slab *next;
+    uint8_t *objects;
+    size_t in_use;
+    size_t num_free;
+    uint16_t free[];
+} slab_t;
+
+typedef struct
+{
+    slab_t *head;
+    size_t count;
+} slab_list_t;
+
+struct kmem_cache
+{
+    const char *name;
+    size_t size;
+    size_t align;
+    void (*ctor)(void *obj);
+
+    uint8_t order;
+    size_t objects_per_slab;
+    size_t objects_offset; // uncolored offset of the first object inside the slab
+    size_t num_colors;
+    size_t next_color;
+
+    slab_list_t partial;
+    slab_list_t full;
+    slab_list_t empty;
+
+    kmem_cache_stats_t stats;
+};
+
+static size_t align_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+static size_t slab_bytes(const kmem_cache_t *cache)
+{
+    return (size_t)PAGE_SIZE << cache->order;
+}
+
+static slab_t *slab_of_object(const kmem_cache_t *cache, void *obj)
+{
+    return (slab_t *)((uintptr_t)obj & ~(uintptr_t)(slab_bytes(cache) - 1));
+}
+
+static void slab_list_push(slab_list_t *list, slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = list->head;
+    if (list->head)
+    {
+        list->head->prev = slab;
+    }
+    list->head = slab;
+    list->count++;
+}
+
+static void slab_list_remove(slab_list_t *list, slab_t *slab)
+{
+    if (slab->prev)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        list->head = slab->next;
+    }
+
+    if (slab->next)
+    {
+        slab->next->prev = slab->prev;
+    }
+    list->count--;
+}
+
+// fits as many objects as possible into a slab of the given order, returns the unused bytes
+static size_t slab_layout(size_t size, size_t align, uint8_t order, size_t *num_objects, size_t *objects_offset)
+{
+    size_t bytes = (size_t)PAGE_SIZE << order;
+    size_t n = (bytes - sizeof(slab_t)) / (size + sizeof(uint16_t));
+    if (n > SLAB_MAX_OBJECTS)
+    {
+        n = SLAB_MAX_OBJECTS;
+    }
+
+    size_t offset = align_up(sizeof(slab_t) + n * sizeof(uint16_t), align);
+    while (n > 0 && offset + n * size > bytes)
+    {
+        n--;
+        offset = align_up(sizeof(slab_t) + n * sizeof(uint16_t), align);
+    }
+
+    *num_objects = n;
+    *objects_offset = offset;
+    return bytes - offset - n * size;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *obj))
+{
+    if (size == 0 || (align & (align - 1)) != 0 || align > PAGE_SIZE)
+    {
+        return NULL;
+    }
+
+    if (align < SLAB_MIN_ALIGN)
+    {
+        align = SLAB_MIN_ALIGN;
+    }
+    size = align_up(size, align);
+
+    // smallest slab that wastes at most an eighth of itself, or the first one that fits anything
+    uint8_t order = 0;
+    size_t num_objects = 0;
+    size_t objects_offset = 0;
+    size_t waste = 0;
+    for (; order <= PMM_MAX_ORDER; order++)
+    {
+        waste = slab_layout(size, align, order, &num_objects, &objects_offset);
+        if (num_objects > 0 && (waste * 8 <= ((size_t)PAGE_SIZE << order) || order >= SLAB_PREFERRED_MAX_ORDER))
+        {
+            break;
+        }
+    }
+
+    if (num_objects == 0)
+    {
+        return NULL;
+    }
+
+    kmem_cache_t *cache = kmalloc(sizeof(kmem_cache_t));
+    if (!cache)
+    {
+        return NULL;
+    }
+
+    memset(cache, 0, sizeof(kmem_cache_t));
+    cache->name = name;
+    cache->size = size;
+    cache->align = align;
+    cache->ctor = ctor;
+    cache->order = order;
+    cache->objects_per_slab = num_objects;
+    cache->objects_offset = objects_offset;
+    cache->num_colors = waste / align + 1;
+
+    cache->stats.object_size = size;
+    cache->stats.objects_per_slab = num_objects;
+    cache->stats.slab_pages = 1UL << order;
+
+    return cache;
+}
+
+static slab_t *slab_create(kmem_cache_t *cache)
+{
+    slab_t *slab = cache->order == 0 ? pmm_alloc() : pmm_alloc_pages(cache->order);
+    if (!slab)
+    {
+        return NULL;
+    }
+
+    // shift every new slab by a different multiple of the alignment, so objects of different slabs don't compete for the same cache lines
+    size_t color = cache->next_color * cache->align;
+    cache->next_color = (cache->next_color + 1) % cache->num_colors;
+
+    slab->objects = (uint8_t *)slab + cache->objects_offset + color;
+    slab->in_use = 0;
+    slab->num_free = cache->objects_per_slab;
+    for (size_t i = 0; i < cache->objects_per_slab; i++)
+    {
+        slab->free[i] = (uint16_t)(cache->objects_per_slab - 1 - i);
+        if (cache->ctor)
+        {
+            cache->ctor(slab->objects + i * cache->size);
+        }
+    }
+
+    cache->stats.slabs++;
+    cache->stats.slabs_created++;
+    cache->stats.total_objects += cache->objects_per_slab;
+
+    return slab;
+}
+
+static void slab_destroy(kmem_cache_t *cache, slab_t *slab)
+{
+    cache->stats.slabs--;
+    cache->stats.slabs_destroyed++;
+    cache->stats.total_objects -= cache->objects_per_slab;
+
+    if (cache->order == 0)
+    {
+        pmm_free((uint64_t *)slab);
+    }
+    else
+    {
+        pmm_free_pages(slab, cache->order);
+    }
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache)
+{
+    if (!cache)
+    {
+        return NULL;
+    }
+
+    slab_t *slab = cache->partial.head;
+    if (!slab)
+    {
+        slab = cache->empty.head;
+        if (slab)
+        {
+            slab_list_remove(&cache->empty, slab);
+        }
+        else
+        {
+            slab = slab_create(cache);
+            if (!slab)
+            {
+                return NULL;
+            }
+        }
+        slab_list_push(&cache->partial, slab);
+    }
+
+    void *obj = slab->objects + slab->free[--slab->num_free] * cache->size;
+    slab->in_use++;
+    if (slab->num_free == 0)
+    {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+
+    cache->stats.allocs++;
+    cache->stats.active_objects++;
+
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj)
+{
+    if (!cache || !obj)
+    {
+        return;
+    }
+
+    slab_t *slab = slab_of_object(cache, obj);
+    size_t index = ((uint8_t *)obj - slab->objects) / cache->size;
+
+    if (slab->num_free == 0)
+    {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+
+    slab->free[slab->num_free++] = (uint16_t)index;
+    slab->in_use--;
+
+    cache->stats.frees++;
+    cache->stats.active_objects--;
+
+    if (slab->in_use == 0)
+    {
+        // keep one empty slab around so a cache that hovers around a slab boundary doesn't hit the pmm every time
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty.count == 0)
+        {
+            slab_list_push(&cache->empty, slab);
+        }
+        else
+        {
+            slab_destroy(cache, slab);
+        }
+    }
+}
+
+size_t kmem_cache_shrink(kmem_cache_t *cache)
+{
+    if (!cache)
+    {
+        return 0;
+    }
+
+    size_t res = 0;
+    while (cache->empty.head)
+    {
+        slab_t *slab = cache->empty.head;
+        slab_list_remove(&cache->empty, slab);
+        slab_destroy(cache, slab);
+        res += 1UL << cache->order;
+    }
+
+    return res;
+}
+
+int kmem_cache_destroy(kmem_cache_t *cache)
+{
+    if (!cache)
+    {
+        return -EINVARG;
+    }
+
+    if (cache->partial.head || cache->full.head)
+    {
+        return -ERECOV;
+    }
+
+    kmem_cache_shrink(cache);
+    kfree(cache);
+
+    return 0;
+}
+
+int kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *stats)
+{
+    if (!cache || !stats)
+    {
+        return -EINVARG;
+    }
+
+    *stats = cache->stats;
+    return 0;
+}
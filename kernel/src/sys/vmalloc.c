@@ -0,0 +1,164 @@
+#include <kernel/vmalloc.h>
+#include <kernel/kmm.h>
+#include <kernel/pmm.h>
+#include <kernel/arena.h>
+
+#define MAP_BATCH_PAGES 512
+
+/*
+ every allocation is followed by one unmapped guard page, so overruns fault instead of
+ silently corrupting the next allocation
+*/
+typedef struct vm_area
+{
+    uintptr_t start;
+    size_t num_pages;
+    struct vm_area *next;
+} vm_area_t;
+
+static page_table_t *pml4 = NULL;
+static vm_area_t *areas = NULL; // sorted by address
+
+int vmalloc_init(page_table_t *kernel_pml4)
+{
+    if (!kernel_pml4)
+    {
+        return -EINVARG;
+    }
+
+    if (vmm_share_kernel_range((void *)VMALLOC_START, VMALLOC_SIZE) < 0)
+    {
+        return -ENOMEM;
+    }
+
+    pml4 = kernel_pml4;
+    return 0;
+}
+
+static void unmap_pages(uintptr_t start, size_t num_pages)
+{
+    pml4_release_range(pml4, (void *)start, num_pages);
+}
+
+void *vmalloc(size_t size)
+{
+    if (!pml4 || size == 0 || size > VMALLOC_SIZE)
+    {
+        return NULL;
+    }
+
+    size_t num_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t span = (num_pages + 1) * PAGE_SIZE;
+
+    // first fit between the existing areas
+    uintptr_t start = VMALLOC_START;
+    vm_area_t *prev = NULL;
+    vm_area_t *next = areas;
+    while (next && next->start - start < span)
+    {
+        start = next->start + (next->num_pages + 1) * PAGE_SIZE;
+        prev = next;
+        next = next->next;
+    }
+
+    if (start + span > VMALLOC_START + VMALLOC_SIZE)
+    {
+        return NULL;
+    }
+
+    vm_area_t *area = kmalloc(sizeof(vm_area_t));
+    if (!area)
+    {
+        return NULL;
+    }
+
+    // pages are mapped one page table worth at a time
+    arena_t scratch = arena_begin();
+    void **pages = arena_alloc(MAP_BATCH_PAGES * sizeof(void *));
+    for (size_t i = 0; pages && i < num_pages; i += MAP_BATCH_PAGES)
+    {
+        size_t count = num_pages - i < MAP_BATCH_PAGES ? num_pages - i : MAP_BATCH_PAGES;
+        for (size_t j = 0; j < count; j++)
+        {
+            pages[j] = pmm_alloc();
+            if (!pages[j])
+            {
+                while (j-- > 0)
+                {
+                    pmm_free(pages[j]);
+                }
+                unmap_pages(start, i);
+                pages = NULL;
+                break;
+            }
+        }
+
+        if (pages && pml4_map_pages(pml4, (void *)(start + i * PAGE_SIZE), pages, count, PAGE_PRESENT | PAGE_WRITABLE | PAGE_NO_EXECUTE) < 0)
+        {
+            // unmap_pages frees the part of the batch that did get mapped
+            for (size_t j = 0; j < count; j++)
+            {
+                if (pml4_get_phys(pml4, (void *)(start + (i + j) * PAGE_SIZE), false) != (uint64_t)pages[j])
+                {
+                    pmm_free(pages[j]);
+                }
+            }
+            unmap_pages(start, i + count);
+            pages = NULL;
+        }
+    }
+    arena_end(scratch);
+
+    if (!pages)
+    {
+        kfree(area);
+        return NULL;
+    }
+
+    area->start = start;
+    area->num_pages = num_pages;
+    area->next = next;
+    if (prev)
+    {
+        prev->next = area;
+    }
+    else
+    {
+        areas = area;
+    }
+
+    return (void *)start;
+}
+
+void vfree(void *ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    vm_area_t *prev = NULL;
+    vm_area_t *area = areas;
+    while (area && area->start != (uintptr_t)ptr)
+    {
+        prev = area;
+        area = area->next;
+    }
+
+    if (!area)
+    {
+        return;
+    }
+
+    if (prev)
+    {
+        prev->next = area->next;
+    }
+    else
+    {
+        areas = area->next;
+    }
+
+    unmap_pages(area->start, area->num_pages);
+    kfree(area);
+}
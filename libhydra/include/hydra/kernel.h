@@ -9,6 +9,26 @@
 #define _SYSCALL_FORK 2
 #define _SYSCALL_EXIT 3
 #define _SYSCALL_PING 4
+#define _SYSCALL_MMAP 6
+#define _SYSCALL_MUNMAP 7
+#define _SYSCALL_MPROTECT 8
+#define _SYSCALL_OPEN 9
+#define _SYSCALL_CLOSE 10
+
+#define OPEN_ACTION_READ 0
+#define OPEN_ACTION_WRITE 1
+#define OPEN_ACTION_CLEAR 2
+#define OPEN_ACTION_CREATE 3
+
+#define MMAP_PROT_NONE 0x0
+#define MMAP_PROT_READ 0x1
+#define MMAP_PROT_WRITE 0x2
+#define MMAP_PROT_EXEC 0x4
+
+#define MMAP_PRIVATE 0x1
+#define MMAP_SHARED 0x2
+#define MMAP_FIXED 0x4
+#define MMAP_ANONYMOUS 0x8
 
 uint64_t syscall(uint64_t num, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5, uint64_t arg6);
 
@@ -18,4 +38,14 @@ uint64_t syscall_fork(void);
 void syscall_exit(uint32_t result);
 uint64_t syscall_ping(uint64_t pid);
 
+// returns the stream index or a negative error
+int64_t syscall_open(const char *path, uint8_t action);
+int64_t syscall_close(uint64_t stream);
+
+// pages are allocated on the first access, returns NULL on failure
+// stream and page aligned offset select the file unless MMAP_ANONYMOUS is set
+void *syscall_mmap(void *addr, size_t length, uint32_t prot, uint32_t flags, uint64_t stream, uint64_t offset);
+int64_t syscall_munmap(void *addr, size_t length);
+int64_t syscall_mprotect(void *addr, size_t length, uint32_t prot);
+
 #endif
\ No newline at end of file
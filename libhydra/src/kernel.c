@@ -2,6 +2,11 @@
 
 uint64_t syscall(uint64_t num, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5, uint64_t arg6)
 {
+    // the kernel takes the fourth to sixth argument from r10, r8 and r9
+    register uint64_t r10 asm("r10") = arg4;
+    register uint64_t r8 asm("r8") = arg5;
+    register uint64_t r9 asm("r9") = arg6;
+
     uint64_t result;
     asm volatile(
         "syscall"
@@ -10,9 +15,9 @@ uint64_t syscall(uint64_t num, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint
             "D"(arg1),
             "S"(arg2),
             "d"(arg3),
-            "r"(arg5),
-            "r"(arg6),
-            "r"(arg4)
+            "r"(r10),
+            "r"(r8),
+            "r"(r9)
         : "rcx", "r11", "memory"
     );
 
@@ -43,3 +48,34 @@ uint64_t syscall_ping(uint64_t pid)
 {
     return syscall(_SYSCALL_PING, pid, 0, 0, 0, 0, 0);
 }
+
+int64_t syscall_open(const char *path, uint8_t action)
+{
+    return (int64_t)syscall(_SYSCALL_OPEN, (uint64_t)path, action, 0, 0, 0, 0);
+}
+
+int64_t syscall_close(uint64_t stream)
+{
+    return (int64_t)syscall(_SYSCALL_CLOSE, stream, 0, 0, 0, 0, 0);
+}
+
+void *syscall_mmap(void *addr, size_t length, uint32_t prot, uint32_t flags, uint64_t stream, uint64_t offset)
+{
+    int64_t res = (int64_t)syscall(_SYSCALL_MMAP, (uint64_t)addr, length, prot, flags, stream, offset);
+    if (res < 0)
+    {
+        return NULL;
+    }
+
+    return (void *)res;
+}
+
+int64_t syscall_munmap(void *addr, size_t length)
+{
+    return (int64_t)syscall(_SYSCALL_MUNMAP, (uint64_t)addr, length, 0, 0, 0, 0);
+}
+
+int64_t syscall_mprotect(void *addr, size_t length, uint32_t prot)
+{
+    return (int64_t)syscall(_SYSCALL_MPROTECT, (uint64_t)addr, length, prot, 0, 0, 0);
+}
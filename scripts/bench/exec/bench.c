@@ -0,0 +1,123 @@
+// times elf_load + elf_map_segments + page faults against a fat32 image in memory
+#include <kernel/proc/task.h>
+#include <kernel/proc/elf.h>
+#include <kernel/proc/vma.h>
+#include <kernel/fs/vfs.h>
+#include <kernel/vmm.h>
+
+int printf(const char *f, ...);
+int kprintf(const char *f, ...);
+void *host_load(const char *path, size_t *size);
+void mock_init(void);
+extern size_t (*shrinker)(void);
+extern size_t pages_live;
+extern filesystem_t fat32_filesystem;
+
+static uint8_t *disk;
+static size_t sectors_read, sectors_written;
+
+static int ram_read(uint64_t lba, uint8_t *buf, blockdev_t *b) { memcpy(buf, disk + lba * 512, 512); sectors_read++; return 0; }
+static int ram_write(uint64_t lba, const uint8_t *buf, blockdev_t *b) { memcpy(disk + lba * 512, buf, 512); sectors_written++; return 0; }
+
+static inline uint64_t tsc(void) { return __builtin_ia32_rdtsc(); }
+
+static void drop_caches(void)
+{
+    while (shrinker && shrinker() > 0)
+        ;
+}
+
+typedef struct { uint64_t cycles; size_t rd, wr; } sample_t;
+
+// all: fault in every page of every area like a program that touches its whole image, otherwise only the entry page
+static sample_t exec_once(bool all)
+{
+    process_t proc;
+    memset(&proc, 0, sizeof(proc));
+    proc.pml4 = pml4_create();
+
+    size_t rd = sectors_read, wr = sectors_written;
+    uint64_t t0 = tsc();
+
+    elf_file_t *elf = elf_load("0:/bin/prog.elf");
+    if (!elf || elf_map_segments(&proc, elf) < 0)
+    {
+        kprintf("load failed %p\n", elf);
+        __builtin_trap();
+    }
+
+    if (all)
+    {
+        for (vma_t *vma = proc.vmas; vma; vma = vma->next)
+            for (uintptr_t page = vma->start; page < vma->end; page += PAGE_SIZE)
+                if (vma_fault(&proc, page, (vma->page_flags & PAGE_WRITABLE) != 0) < 0)
+                    __builtin_trap();
+    }
+    else if (vma_fault(&proc, elf_entry(elf), false) < 0)
+    {
+        __builtin_trap();
+    }
+
+    uint64_t t1 = tsc();
+    sample_t s = {t1 - t0, sectors_read - rd, sectors_written - wr};
+
+    vma_free_all(&proc);
+    elf_free(elf);
+    pml4_destroy(proc.pml4);
+    return s;
+}
+
+static int cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+void qsort(void *, size_t, size_t, int (*)(const void *, const void *));
+
+#define RUNS 201
+
+static void run(const char *name, bool all, bool cold)
+{
+    static uint64_t cycles[RUNS];
+    sample_t s = {0};
+    exec_once(all); // warm the host caches and the code paths
+    for (int i = 0; i < RUNS; i++)
+    {
+        if (cold)
+            drop_caches();
+        s = exec_once(all);
+        cycles[i] = s.cycles;
+    }
+    qsort(cycles, RUNS, sizeof(uint64_t), cmp);
+    printf("%-22s median %9llu cycles  min %9llu  sectors read %5zu written %zu  pages live after %zu\n", name,
+           (unsigned long long)cycles[RUNS / 2], (unsigned long long)cycles[0], s.rd, s.wr, pages_live);
+}
+
+int main(int argc, char **argv)
+{
+    size_t size;
+    disk = host_load(argv[1], &size);
+    mock_init();
+
+    static blockdev_t bdev;
+    bdev.read_block = ram_read;
+    bdev.write_block = ram_write;
+    bdev.block_size = 512;
+    bdev.num_blocks = size / 512;
+    static virtual_blockdev_t vbdev;
+    vbdev.bdev = &bdev;
+    vbdev.lba_offset = 2048;
+
+    register_filesystem(&fat32_filesystem);
+    if (vfs_mount_blockdev(&vbdev) < 0)
+    {
+        kprintf("mount failed\n");
+        return 1;
+    }
+
+    run("cold, entry page", false, true);
+    run("cold, every page", true, true);
+    run("warm, entry page", false, false);
+    run("warm, every page", true, false);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/bash
+# times the exec loader of two kernel revisions on the host, see bench.c
+# usage: exec_bench.sh [before] [after], defaults to the commits around the header-only elf_load
+# the loader sources are real, the pmm, page tables and heap are stand-ins from mocks.c shared by both builds
+
+set -e
+
+DIR="`cd "$(dirname "${BASH_SOURCE[0]}")" && pwd`"
+BEFORE=${1:-4ff6454}
+AFTER=${2:-1b36cc2}
+WORK=`mktemp -d`
+trap 'rm -rf "$WORK"' EXIT
+
+SOURCES="fs/fat32.c fs/vfs.c fs/page_cache.c proc/vma.c proc/elf.c sys/arena.c dev/blockdev.c misc/string.c"
+CFLAGS="-O2 -ffreestanding -fno-builtin -w"
+
+gcc -static -nostdlib -fno-pic -no-pie -O0 -T "$DIR/../../../apps/sysbench/linker.ld" -o "$WORK/prog" "$DIR/prog.c" 2>/dev/null
+python3 "$DIR/gen.py" "$WORK/prog" "$WORK/disk.img"
+
+gcc -c -O2 -w -o "$WORK/mocks.o" "$DIR/mocks.c"
+gcc -c -O2 -w -o "$WORK/host.o" "$DIR/host.c"
+
+for rev in "$BEFORE" "$AFTER"; do
+    tree="$WORK/$rev"
+    mkdir -p "$tree/o"
+    git -C "$DIR/../../.." archive "$rev" kernel | tar -x -C "$tree"
+    for f in $SOURCES bench; do
+        src="$tree/kernel/src/$f"
+        [[ $f == bench ]] && src="$DIR/bench.c"
+        gcc -c $CFLAGS -I"$tree/kernel/include" -o "$tree/o/$(basename $f .c).o" "$src"
+    done
+    gcc -o "$tree/bench" "$tree"/o/*.o "$WORK/mocks.o" "$WORK/host.o"
+
+    echo "== $rev"
+    "$tree/bench" "$WORK/disk.img"
+done
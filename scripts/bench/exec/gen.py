@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+# writes a fat32 disk image holding one file, 0:/bin/prog.elf
+# usage: gen.py <program> <image>
+
+import struct, sys
+
+prog = open(sys.argv[1], 'rb').read()
+out = sys.argv[2]
+# laid out like scripts/build.sh: a 64 MiB disk, the partition at 1 MiB, mkdosfs -F32 defaults (one sector per cluster)
+BPS, SPC, RES, NFATS, TOTAL = 512, 1, 32, 2, 131072 - 2048
+FATSZ = 1008
+PART = 2048
+data_start = RES + NFATS * FATSZ
+CL = BPS * SPC
+img = bytearray(TOTAL * BPS)
+disk = bytearray(PART * BPS)
+
+bs = bytearray(512)
+bs[0:3] = b'\xEB\x58\x90'
+bs[3:11] = b'HYDRAOS '
+struct.pack_into('<HBHBHHBHHHII', bs, 11, BPS, SPC, RES, NFATS, 0, 0, 0xF8, 0, 63, 255, 0, TOTAL)
+struct.pack_into('<IHHIHH', bs, 36, FATSZ, 0, 0, 2, 1, 6)
+struct.pack_into('<BBBI', bs, 64, 0x80, 0, 0x29, 0x1234)
+bs[71:82] = b'HYDRAOS    '
+bs[82:90] = b'FAT32   '
+bs[510:512] = b'\x55\xAA'
+img[0:512] = bs
+img[6 * BPS:7 * BPS] = bs
+
+fat = [0] * (FATSZ * BPS // 4)
+fat[0], fat[1] = 0x0FFFFFF8, 0x0FFFFFFF
+EOC = 0x0FFFFFFF
+fat[2] = EOC  # root
+fat[3] = EOC  # bin
+nclusters = (len(prog) + CL - 1) // CL
+first = 4
+for i in range(nclusters):
+    fat[first + i] = first + i + 1 if i + 1 < nclusters else EOC
+
+def cluster_off(c):
+    return (data_start + (c - 2) * SPC) * BPS
+
+def dirent(name, attr, cluster, size):
+    return struct.pack('<11sBBBHHHHHHHI', name, attr, 0, 0, 0, 0, 0, cluster >> 16, 0, 0, cluster & 0xFFFF, size)
+
+o = cluster_off(2)
+img[o:o + 32] = dirent(b'BIN        ', 0x10, 3, 0)
+o = cluster_off(3)
+img[o:o + 32] = dirent(b'.          ', 0x10, 3, 0)
+img[o + 32:o + 64] = dirent(b'..         ', 0x10, 0, 0)
+img[o + 64:o + 96] = dirent(b'PROG    ELF', 0x20, first, len(prog))
+o = cluster_off(first)
+img[o:o + len(prog)] = prog
+
+fatb = struct.pack('<%dI' % len(fat), *fat)
+for n in range(NFATS):
+    s = (RES + n * FATSZ) * BPS
+    img[s:s + len(fatb)] = fatb
+open(out, 'wb').write(disk + img)
@@ -0,0 +1,9 @@
+// host side of bench.c, kept apart because bench.c is built against the kernel headers
+#include <stdio.h>
+#include <stdlib.h>
+void *host_load(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    fseek(f, 0, SEEK_END); *size = ftell(f); fseek(f, 0, SEEK_SET);
+    void *b = malloc(*size); fread(b, 1, *size, f); fclose(f); return b;
+}
@@ -0,0 +1,128 @@
+// host stand-ins for the pmm, vmm, heap and console; identical for both trees
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+
+#define PAGE_SIZE 4096
+#define POOL_PAGES (64 * 1024)
+
+static uint8_t *pool;
+static uint16_t refs[POOL_PAGES];
+static uint32_t free_stack[POOL_PAGES];
+static size_t free_top;
+size_t pages_live;
+
+void mock_init(void)
+{
+    pool = mmap(NULL, (size_t)POOL_PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    for (size_t i = 0; i < POOL_PAGES; i++)
+        free_stack[free_top++] = POOL_PAGES - 1 - i;
+}
+
+static size_t pidx(void *p)
+{
+    size_t i = ((uint8_t *)p - pool) / PAGE_SIZE;
+    if ((uint8_t *)p < pool || i >= POOL_PAGES) { fprintf(stderr, "bad page %p\n", p); abort(); }
+    return i;
+}
+
+void *pmm_alloc(void)
+{
+    if (!free_top) return NULL;
+    size_t i = free_stack[--free_top];
+    refs[i] = 1;
+    pages_live++;
+    return pool + i * PAGE_SIZE;
+}
+void *pmm_alloc_zeroed(void) { void *p = pmm_alloc(); if (p) memset(p, 0, PAGE_SIZE); return p; }
+void pmm_free(uint64_t *p)
+{
+    size_t i = pidx(p);
+    if (!refs[i]) { fprintf(stderr, "double free %p\n", (void *)p); abort(); }
+    if (--refs[i] == 0) { free_stack[free_top++] = i; pages_live--; }
+}
+int pmm_ref(void *p) { size_t i = pidx(p); if (!refs[i]) return -2; refs[i]++; return 0; }
+uint32_t pmm_get_refs(void *p) { return refs[pidx(p)]; }
+void *pmm_alloc_pages(uint8_t order) { return aligned_alloc(PAGE_SIZE, (size_t)PAGE_SIZE << order); }
+void pmm_free_pages(void *p, uint8_t order) { (void)order; free(p); }
+
+size_t (*shrinker)(void);
+int pmm_register_shrinker(size_t (*s)(void)) { shrinker = s; return 0; }
+
+void *kmalloc(size_t s) { return malloc(s); }
+void kfree(void *p) { free(p); }
+void *krealloc(void *p, size_t s) { return realloc(p, s); }
+
+// vmalloc backs every page with a pmm page like the real one, the buffer itself comes from the host
+typedef struct { void *buf; size_t n; void *pages[]; } vm_t;
+static vm_t *vm_table[64];
+void *vmalloc(size_t size)
+{
+    size_t n = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    vm_t *v = malloc(sizeof(vm_t) + n * sizeof(void *));
+    v->n = n;
+    for (size_t i = 0; i < n; i++) v->pages[i] = pmm_alloc();
+    v->buf = aligned_alloc(PAGE_SIZE, n * PAGE_SIZE);
+    for (int i = 0; i < 64; i++) if (!vm_table[i]) { vm_table[i] = v; break; }
+    return v->buf;
+}
+void vfree(void *p)
+{
+    for (int i = 0; i < 64; i++)
+        if (vm_table[i] && vm_table[i]->buf == p)
+        {
+            vm_t *v = vm_table[i];
+            for (size_t j = 0; j < v->n; j++) pmm_free(v->pages[j]);
+            free(v->buf); free(v); vm_table[i] = NULL; return;
+        }
+    abort();
+}
+
+typedef struct kmem_cache { size_t size; } kmem_cache_t;
+kmem_cache_t *kmem_cache_create(const char *n, size_t s, size_t a, void (*c)(void *)) { kmem_cache_t *k = malloc(sizeof *k); k->size = s; return k; }
+void *kmem_cache_alloc(kmem_cache_t *c) { return malloc(c->size); }
+void kmem_cache_free(kmem_cache_t *c, void *o) { free(o); }
+
+uint32_t cpu_get_id(void) { return 0; }
+int kprintf(const char *f, ...) { va_list va; va_start(va, f); int r = vfprintf(stderr, f, va); va_end(va); return r; }
+
+// page tables: open addressing on the virtual page number
+#define PT_SLOTS 8192
+typedef struct { uint64_t v; uint64_t p; uint64_t f; } pte_t;
+typedef struct page_table { pte_t e[PT_SLOTS]; } page_table_t;
+page_table_t *pml4_create(void) { return calloc(1, sizeof(page_table_t)); }
+size_t pml4_destroy(page_table_t *t) { free(t); return 1; }
+static pte_t *slot(page_table_t *t, uint64_t v, bool add)
+{
+    uint64_t h = (v >> 12) * 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < PT_SLOTS; i++)
+    {
+        pte_t *e = &t->e[(h + i) % PT_SLOTS];
+        if (e->v == v) return (add || e->p) ? e : NULL;
+        if (!e->v) { if (!add) return NULL; e->v = v; return e; }
+    }
+    abort();
+}
+int pml4_map(page_table_t *t, void *v, void *p, uint64_t f) { pte_t *e = slot(t, (uint64_t)v, true); e->p = (uint64_t)p; e->f = f; return 0; }
+uint64_t pml4_get_phys(page_table_t *t, void *v, bool u) { pte_t *e = slot(t, (uint64_t)v & ~0xFFFull, false); return e ? e->p + ((uint64_t)v & 0xFFF) : 0; }
+uint64_t pml4_get_flags(page_table_t *t, void *v) { pte_t *e = slot(t, (uint64_t)v & ~0xFFFull, false); return e ? e->f : 0; }
+int pml4_unmap_range(page_table_t *t, void *v, size_t n)
+{
+    for (size_t i = 0; i < n; i++) { pte_t *e = slot(t, (uint64_t)v + i * PAGE_SIZE, false); if (e) e->p = 0; }
+    return 0;
+}
+int pml4_protect_range(page_table_t *t, void *v, size_t n, uint64_t f)
+{
+    for (size_t i = 0; i < n; i++) { pte_t *e = slot(t, (uint64_t)v + i * PAGE_SIZE, false); if (e) e->f = f; }
+    return 0;
+}
+int pml4_release_range(page_table_t *t, void *v, size_t n)
+{
+    for (size_t i = 0; i < n; i++) { pte_t *e = slot(t, (uint64_t)v + i * PAGE_SIZE, false); if (e) { pmm_free((uint64_t *)e->p); e->p = 0; } }
+    return 0;
+}
+int pml4_share_range(page_table_t *d, page_table_t *s, void *v, size_t n, uint64_t f) { abort(); }
@@ -0,0 +1,6 @@
+// test program for exec_bench.sh, 192 KiB text, 64 KiB rodata, 32 KiB data and 64 KiB bss
+__attribute__((section(".text"))) const unsigned char code[192 * 1024] = {0x90, 1, 2, 3};
+const unsigned char table[64 * 1024] = {1, 2, 3};
+unsigned char data[32 * 1024] = {4, 5, 6};
+unsigned char bss[64 * 1024];
+void _start(void) { for (;;); }